@@ -6,15 +6,27 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define ACK "[ACK] "
 #define RECEIVED "[RECV] "
 
-#define NUM_RSP_SLOTS 103
-#define MAX_NUM_SUBEVENTS 46
 #define EVENTS_PER_BLOCK 3
 #define PACKET_SIZE 5
 #define NAME_LEN 30
 
+#define ACTIVE_SLOT_WORDS DIV_ROUND_UP(NUM_RSP_SLOTS, 32)
+#define NO_REGISTER_SLOT UINT8_MAX
+
+BUILD_ASSERT(CONFIG_NUM_REGISTER_SLOTS < NO_REGISTER_SLOT);
+
 typedef struct {
     uint16_t dev_id;
-    uint8_t inactive_for;
+    /**
+     * Index into register_subevent_data if this slot is a register slot,
+     * NO_REGISTER_SLOT otherwise.
+     */
+    uint8_t reg_idx;
+    /**
+     * Value of subevent_events for this slot's subevent when the device last
+     * responded.
+     */
+    uint16_t last_seen;
 } slot_data_t;
 
 typedef enum {
@@ -26,11 +38,30 @@ typedef enum {
 } state_t;
 typedef state_t state_func_t();
 
+/**
+ * \brief Stages of response_filter, cheapest first.
+ * Only responses that pass all of them get their MAC checked, so a flood of
+ * forged or misrouted responses costs a few compares each.
+ */
+typedef enum {
+    RSP_REJECT_LENGTH,
+    RSP_REJECT_SLOT,
+    RSP_REJECT_COUNTER,
+    RSP_REJECT_MAC,
+    RSP_REJECT_STAGES,
+    RSP_ACCEPTED = RSP_REJECT_STAGES
+} rsp_filter_stage_t;
+
 static void request_cb(struct bt_le_ext_adv *adv,
                        const struct bt_le_per_adv_data_request *request);
 static void response_cb(struct bt_le_ext_adv *adv,
                         struct bt_le_per_adv_response_info *info,
                         struct net_buf_simple *buf);
+static void request_handle(struct bt_le_ext_adv *adv,
+                           const struct bt_le_per_adv_data_request *request);
+static void response_handle(struct bt_le_ext_adv *adv,
+                            struct bt_le_per_adv_response_info *info,
+                            struct net_buf_simple *buf);
 
 static void button_cb(const struct device *dev, struct gpio_callback *cb);
 
@@ -44,9 +75,32 @@ static state_t run_state();
 
 K_SEM_DEFINE(reboot_sem, 0, 1);
 
-static register_data_t reserve_slot();
+static bool prepare_subevent(uint8_t subevent, struct net_buf_simple *buf);
+static void sign_subevents(struct net_buf_simple *bufs[],
+                           const uint8_t subevents[], size_t count);
+static struct net_buf *pipeline_take(uint8_t subevent);
+static void pipeline_drop(uint8_t next);
+static void pipeline_worker(void *p1, void *p2, void *p3);
+static bool subevent_dropped(uint8_t subevent);
+static rsp_filter_stage_t
+response_filter(const struct bt_le_per_adv_response_info *info,
+                const struct net_buf_simple *buf, uint16_t *sender_id);
+
+static void register_slot_assign(uint8_t reg_idx);
+static void register_slots_refill();
+static void slot_activate(uint8_t subevent, uint8_t rsp_slot, uint16_t dev_id);
+static void slot_deactivate(uint8_t subevent, uint8_t rsp_slot);
+static void init_device_counters(uint64_t value);
 void init_bufs(void);
 static int set_adv_data();
+static void mark_adv_data_dirty();
+static void refresh_adv_data();
+static void counter_commit();
+static void counter_commit_request();
+static void event_start();
+static bool message_counter(uint64_t *last, uint64_t *value);
+static uint64_t counter_peek();
+static void latency_deadlines_set();
 
 static state_t curr_state = INITIALIZE;
 state_func_t *const states[NUM_STATES] = {[INITIALIZE] = &init,
@@ -54,32 +108,174 @@ state_func_t *const states[NUM_STATES] = {[INITIALIZE] = &init,
                                           [FAULT_HANDLING] = &fault_handling,
                                           [SOFT_REBOOT] = &soft_reboot};
 
-K_MUTEX_DEFINE(reserve_mutex);
-static register_data_t last_used = {.subevent = 0,
-                                    .rsp_slot = CONFIG_NUM_REGISTER_SLOTS};
-
+/**
+ * Slots advertised for registering, guarded by slots_lock together with the
+ * reg_idx of the slots they point at.
+ */
 register_data_t register_subevent_data[CONFIG_NUM_REGISTER_SLOTS];
-
-#define TO_SEND_BUF_SIZE 251
+/**
+ * Register slots that couldn't be moved to a new slot since every slot was
+ * taken. They still point at the slot their last device registered in and
+ * get a new one once a slot is freed.
+ */
+static ATOMIC_DEFINE(register_slots_stale, CONFIG_NUM_REGISTER_SLOTS);
+
+#define TO_SEND_BUF_SIZE (SUBEVENT_DATA_MAX_LEN + COUNTER_WIRE_SLACK)
+
+/**
+ * The controller asks for at most as many subevents as it has TX buffers, so
+ * the pipeline needs to hold that many to serve a whole data request. The pool
+ * has as many buffers again for subevents request_cb builds inline, which are
+ * all signed together before being sent.
+ */
+#define SUBEVENT_TX_BUF_COUNT                                                  \
+    (CONFIG_SUBEVENT_PIPELINE_DEPTH +                                          \
+     CONFIG_BT_CTLR_SDC_PERIODIC_ADV_RSP_TX_BUFFER_COUNT)
+
+BUILD_ASSERT(CONFIG_SUBEVENT_PIPELINE_DEPTH >=
+                 CONFIG_BT_CTLR_SDC_PERIODIC_ADV_RSP_TX_BUFFER_COUNT,
+             "Subevent pipeline can't cover a whole data request");
+// Subevents are built for the event after the last one sent, so the pipeline
+// can't hold a subevent twice
+BUILD_ASSERT(CONFIG_SUBEVENT_PIPELINE_DEPTH < MAX_NUM_SUBEVENTS,
+             "Subevent pipeline spans more than one event");
 
 static struct bt_le_per_adv_subevent_data_params
-    subevent_data_params[MAX_NUM_SUBEVENTS];
-static struct net_buf_simple bufs[MAX_NUM_SUBEVENTS];
-static uint8_t backing_store[MAX_NUM_SUBEVENTS][TO_SEND_BUF_SIZE];
-
-BUILD_ASSERT(ARRAY_SIZE(bufs) == ARRAY_SIZE(subevent_data_params));
+    subevent_data_params[CONFIG_BT_CTLR_SDC_PERIODIC_ADV_RSP_TX_BUFFER_COUNT];
+NET_BUF_POOL_FIXED_DEFINE(subevent_tx_pool, SUBEVENT_TX_BUF_COUNT,
+                          TO_SEND_BUF_SIZE, 0, NULL);
 
 static slot_data_t rsp_slots[MAX_NUM_SUBEVENTS][NUM_RSP_SLOTS];
+/**
+ * Number of periodic events each subevent was handed to the controller in.
+ * Liveness of a slot is the difference between this and the slot's last_seen.
+ * Subevents are built for the event after this one, building one again after
+ * a pipeline drop doesn't count an event twice.
+ */
+static uint16_t subevent_events[MAX_NUM_SUBEVENTS];
+/**
+ * Bitmap of slots with a registered device for each subevent, so that
+ * preparing a subevent only visits occupied slots.
+ */
+static uint32_t active_slots[MAX_NUM_SUBEVENTS][ACTIVE_SLOT_WORDS];
+/**
+ * Guards rsp_slots, subevent_events and active_slots which are shared between
+ * the pipeline worker and response_cb.
+ */
+static struct k_spinlock slots_lock;
+/**
+ * Counters accepted from each scanner, indexed by sender_id. Every device is
+ * checked only against its own window, so a device that is ahead can't get
+ * the responses of the others rejected. Only used from response_cb.
+ */
+static replay_window_t device_windows[CONFIG_MAX_SCANNER_ID + 1];
+
+/**
+ * Furthest a response counter may be ahead of both the sender's newest counter
+ * and the advertiser's own. A scanner continues up to a lease ahead after a
+ * reset, anything further can't verify and is dropped before the MAC.
+ */
+#define RSP_COUNTER_MAX_AHEAD (2 * (uint64_t)CONFIG_CRYPTO_COUNTER_LEASE)
+
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+BUILD_ASSERT(RSP_COUNTER_MAX_AHEAD <
+                 BIT64(CONFIG_TRANSFER_COUNTER_WIRE_BITS - 1),
+             "Truncated counters can't cover a counter lease");
+#endif
+
+/**
+ * Number of responses dropped at each stage.
+ */
+static atomic_t rsp_rejected[RSP_REJECT_STAGES];
+
+#define PIPELINE_IN_STEP -1
+
+typedef struct {
+    struct net_buf *buf;
+    uint8_t subevent;
+} prepared_subevent_t;
+
+/**
+ * \brief Ring of signed subevents prepared ahead of the controller.
+ * The worker fills entries at pipeline_head in subevent order with buffers
+ * from subevent_tx_pool and request_cb hands them out from pipeline_tail. If
+ * the head of the ring isn't the requested subevent request_cb builds it
+ * inline, drops the ring and tells the worker where to continue through
+ * pipeline_resync.
+ *
+ * Every drop bumps pipeline_gen. A run the worker started before it was built
+ * for the old position and is thrown away instead of published. Publishing
+ * and dropping hold pipeline_lock, so a run can't slip in between.
+ */
+static prepared_subevent_t pipeline[CONFIG_SUBEVENT_PIPELINE_DEPTH];
+static atomic_t pipeline_head;
+static atomic_t pipeline_tail;
+static atomic_t pipeline_resync = ATOMIC_INIT(PIPELINE_IN_STEP);
+static atomic_t pipeline_gen;
+static struct k_spinlock pipeline_lock;
+K_SEM_DEFINE(pipeline_sem, 0, 1);
+
+/**
+ * Number of subevents handed to the controller from the pipeline and number
+ * of subevents request_cb had to build itself.
+ */
+static atomic_t pipeline_prebuilt;
+static atomic_t pipeline_inline;
+
+K_THREAD_STACK_DEFINE(pipeline_stack, CONFIG_SUBEVENT_PIPELINE_STACK_SIZE);
+static struct k_thread pipeline_thread;
 static rsp_data_t current_rsp;
 
 static struct bt_le_ext_adv *pawr_adv;
 subevent_sel_info_t selection_data;
 
-NET_BUF_SIMPLE_DEFINE_STATIC(adv_data, sizeof(advertisement_data_t) + HASH_LEN);
+#define ADV_DATA_LEN                                                           \
+    (CONFIG_NUM_REGISTER_SLOTS * sizeof(register_data_t) +                     \
+     sizeof(subevent_sel_info_t) + sizeof(uint64_t) + HASH_LEN)
+
+BUILD_ASSERT(ADV_DATA_LEN < UINT8_MAX,
+             "Register slots don't fit in manufacturer data");
+
+NET_BUF_SIMPLE_DEFINE_STATIC(adv_data, ADV_DATA_LEN);
+K_MUTEX_DEFINE(adv_data_mutex);
+/**
+ * Set when register_subevent_data changed since adv data was last pushed.
+ */
+static atomic_t adv_data_dirty;
+/**
+ * Counter value carried by the pushed adv data.
+ */
+static uint64_t adv_data_counter;
+/**
+ * Number of adv data updates that were coalesced or not needed.
+ */
+static atomic_t adv_updates_skipped;
 static uint8_t adv_flags = (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR);
 
 // crypto
 static crypto_counter_t counter = {.storage_uid = COUNTER_ID};
+static struct k_spinlock counter_lock;
+K_MUTEX_DEFINE(counter_commit_mutex);
+/**
+ * Set when a counter lease ran low outside the pipeline worker, which commits
+ * it before building anything else. Subevents and adv data aren't signed with
+ * a counter past counter.reserved meanwhile.
+ */
+static atomic_t counter_commit_pending;
+/**
+ * Counter values last signed into adv data, into each subevent and into any
+ * message. Scanners accept a value only once, so message_counter never signs
+ * a message with a value the same scanners already got. Guarded by
+ * counter_lock.
+ */
+static uint64_t adv_signed_counter;
+static uint64_t subevent_signed_counters[MAX_NUM_SUBEVENTS];
+static uint64_t newest_signed_counter;
+/**
+ * subevent_events[0] + 1 of the last event event_start ran for. Only used by
+ * the pipeline worker.
+ */
+static uint16_t event_started;
 static struct bt_le_per_adv_param per_adv_params = {
     .interval_min = 2000,
     .interval_max = 2000,
@@ -102,98 +298,453 @@ static void button_cb(const struct device *dev, struct gpio_callback *cb) {
     k_sem_give(&reboot_sem);
 }
 
-static uint64_t rollover;
-static void request_cb(struct bt_le_ext_adv *adv,
-                       const struct bt_le_per_adv_data_request *request) {
+static void subevent_send(struct bt_le_ext_adv *adv,
+                          struct bt_le_per_adv_subevent_data_params *params,
+                          uint8_t subevent, struct net_buf *buf) {
+    k_spinlock_key_t key;
     int err;
-    uint8_t to_send;
-    ack_data_t d;
-    subevent_data_t subevent_data;
-    ack_data_t ack_data[NUM_RSP_SLOTS] = {0};
-    if (rollover > 0) {
-        counter.value += rollover;
-        rollover = 0;
+
+    params->subevent = subevent;
+    params->response_slot_start = 0;
+    params->response_slot_count = NUM_RSP_SLOTS;
+    params->data = &buf->b;
+    subevent_req_counter += 1;
+
+    key = k_spin_lock(&slots_lock);
+    subevent_events[subevent]++;
+    k_spin_unlock(&slots_lock, key);
+
+    err = bt_le_per_adv_set_subevent_data(adv, 1, params);
+    if (err) {
+        LOG_WRN(INFO "Failed to set subevent data (err %d)", err);
     }
+    // Subevent data is copied into the HCI command, so the buffer can be
+    // reused right away
+    net_buf_unref(buf);
+}
 
-    subevent_data._register_data_count = 0;
-    subevent_data._ack_data_count = NUM_RSP_SLOTS;
-    subevent_data.register_data = register_subevent_data;
-    subevent_data.ack_data = ack_data;
+/**
+ * \brief Callbacks of the controller, recorded and timed around the handlers.
+ */
+static void request_cb(struct bt_le_ext_adv *adv,
+                       const struct bt_le_per_adv_data_request *request) {
+    uint32_t start = latency_start();
+
+    if (IS_ENABLED(CONFIG_ADV_CAPTURE))
+        capture_request(request, counter_peek());
+    request_handle(adv, request);
+    latency_end(LATENCY_REQUEST_CB, start);
+}
+
+static void response_cb(struct bt_le_ext_adv *adv,
+                        struct bt_le_per_adv_response_info *info,
+                        struct net_buf_simple *buf) {
+    uint32_t start = latency_start();
+
+    if (IS_ENABLED(CONFIG_ADV_CAPTURE))
+        capture_response(info, buf, counter_peek());
+    response_handle(adv, info, buf);
+    latency_end(LATENCY_RESPONSE_CB, start);
+}
+
+static void request_handle(struct bt_le_ext_adv *adv,
+                           const struct bt_le_per_adv_data_request *request) {
+    uint8_t to_send;
+    struct net_buf *buf;
+    struct net_buf *inline_bufs[ARRAY_SIZE(subevent_data_params)];
+    struct net_buf_simple *to_sign[ARRAY_SIZE(subevent_data_params)];
+    uint8_t inline_subevents[ARRAY_SIZE(subevent_data_params)];
+    size_t num_inline = 0;
 
     to_send = MIN(request->count, ARRAY_SIZE(subevent_data_params));
 
     for (size_t i = 0; i < to_send; i++) {
-        size_t subevent = (request->start + i) % per_adv_params.num_subevents;
-        if (subevent == 0) {
-            rollover++;
-            if (set_adv_data() != 0)
-                LOG_ERR("Couldn't update adv data");
+        uint8_t subevent = (request->start + i) % per_adv_params.num_subevents;
+
+        if (subevent_dropped(subevent))
+            continue;
+
+        // After the first miss the pipeline got dropped, the rest of the
+        // request is built here
+        buf = num_inline == 0 ? pipeline_take(subevent) : NULL;
+        if (buf) {
+            atomic_inc(&pipeline_prebuilt);
+            subevent_send(adv, &subevent_data_params[i], subevent, buf);
+            continue;
         }
-        // Ignore register slots while adding to free list
 
-        for (size_t j = 0; j < NUM_RSP_SLOTS; j++) {
+        // Worker didn't keep up or is out of step with the controller
+        atomic_inc(&pipeline_inline);
+        buf = net_buf_alloc(&subevent_tx_pool, K_NO_WAIT);
+        if (!buf) {
+            LOG_WRN(INFO "No TX buffer for subevent %d", subevent);
+            continue;
+        }
+        if (!prepare_subevent(subevent, &buf->b)) {
+            // Counter is past its lease until the worker commits it
+            net_buf_unref(buf);
+            continue;
+        }
+        inline_bufs[num_inline] = buf;
+        to_sign[num_inline] = &buf->b;
+        inline_subevents[num_inline++] = subevent;
+    }
+
+    if (num_inline == 0)
+        return;
+
+    sign_subevents(to_sign, inline_subevents, num_inline);
+    for (size_t i = 0; i < num_inline; i++) {
+        subevent_send(adv, &subevent_data_params[i], inline_subevents[i],
+                      inline_bufs[i]);
+    }
+    // Worker continues after the last subevent built here, whatever it
+    // prepared meanwhile started at the first miss
+    pipeline_drop((inline_subevents[num_inline - 1] + 1) %
+                  per_adv_params.num_subevents);
+}
+
+/**
+ * \brief Serializes subevent into buf, without signing it.
+ * Uses the counter the pipeline worker advanced with event_start, a subevent
+ * request_cb builds again inline before that gets a fresh one.
+ *
+ * \return false if the counter can't be signed with before it is committed,
+ * nothing was changed then
+ */
+static bool prepare_subevent(uint8_t subevent, struct net_buf_simple *buf) {
+    k_spinlock_key_t key;
+    subevent_data_t subevent_data;
+    ack_set_t acks;
+    uint8_t expired[NUM_RSP_SLOTS];
+    size_t num_expired = 0;
+
+    if (!message_counter(&subevent_signed_counters[subevent],
+                         &subevent_data.counter))
+        return false;
+
+    subevent_data._register_data_count = 0;
+    subevent_data.register_data = register_subevent_data;
+    subevent_data.acks = &acks;
+
+    key = k_spin_lock(&slots_lock);
+    uint16_t event = subevent_events[subevent] + 1;
+    ack_set_init(&acks);
+    for (size_t w = 0; w < ACTIVE_SLOT_WORDS; w++) {
+        uint32_t active = active_slots[subevent][w];
+
+        while (active) {
+            uint8_t j = w * 32 + find_lsb_set(active) - 1;
             slot_data_t *s = &rsp_slots[subevent][j];
-            s->inactive_for++;
-            if (s->dev_id != 0 &&
-                s->inactive_for > 3 * EVENTS_PER_BLOCK) {
-                LOG_INF(INFO "Device with id %d, disconnected", s->dev_id);
-                s->dev_id = 0;
-                s->inactive_for = 0;
+            uint16_t inactive_for = event - s->last_seen;
 
-                register_data_t freed = {subevent, j};
-                if (free_list_append(freed) != 0) {
-                    LOG_WRN(INFO "free list full");
-                    // TODO handle this
-                }
+            active &= active - 1;
+            if (inactive_for > 3 * EVENTS_PER_BLOCK) {
+                LOG_INF(INFO "Device with id %d, disconnected", s->dev_id);
+                slot_deactivate(subevent, j);
+                expired[num_expired++] = j;
+                continue;
             }
-            if (s->inactive_for == 1 && s->dev_id != 0) {
-                // There was data in prev slot, return ack
-                d = (ack_data_t){.ack_id = s->dev_id};
+            if (inactive_for == 1) {
+                // There was data in prev slot, return ack. Slots without
+                // data are nacked by leaving them out of the set.
+                if (ack_set_add(&acks, j, s->dev_id) != TRANSFER_NO_ERROR) {
+                    LOG_WRN(ACK "ack set full, nacking slot %d", j);
+                    continue;
+                }
                 LOG_INF(ACK "1");
-            } else {
-                // There wasn't any data in prev slot return nack
-                d = (ack_data_t){.ack_id = 0};
             }
-            ack_data[j] = d;
         }
-        subevent_data.counter = counter.value + rollover;
-
-        net_buf_simple_reset(&bufs[i]);
-        subevent_data_with_reg_serialize(&subevent_data, &bufs[i]);
-        sign_message(&bufs[i], ADVERTISER_KEY_ID);
-
-        subevent_data_params[i].subevent =
-            (request->start + i) % per_adv_params.num_subevents;
-        subevent_data_params[i].response_slot_start = 0;
-        subevent_data_params[i].response_slot_count = NUM_RSP_SLOTS;
-        subevent_data_params[i].data = &bufs[i];
-        subevent_req_counter += 1;
-        err = bt_le_per_adv_set_subevent_data(adv, 1, &subevent_data_params[i]);
-        if (err) {
-            LOG_WRN(INFO "Failed to set subevent data (err %d)", err);
+    }
+    k_spin_unlock(&slots_lock, key);
+
+    for (size_t i = 0; i < num_expired; i++) {
+        slot_allocator_free((register_data_t){subevent, expired[i]});
+    }
+
+    net_buf_simple_reset(buf);
+    subevent_data_with_reg_serialize(&subevent_data, buf);
+    return true;
+}
+
+/**
+ * \brief Signs prepared subevents with as few MAC computations as possible.
+ * subevents holds the number of each buffer, ascending except for wrapping
+ * around to subevent 0.
+ */
+static void sign_subevents(struct net_buf_simple *bufs[],
+                           const uint8_t subevents[], size_t count) {
+    uint32_t start;
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+    struct net_buf_simple *batch[BATCH_SIZE];
+    uint8_t group;
+
+    for (size_t i = 0; i < count;) {
+        // Subevents of one batch share a tree, the ones not built here are
+        // signed as missing
+        memset(batch, 0, sizeof(batch));
+        group = subevents[i] / BATCH_SIZE;
+        for (; i < count && subevents[i] / BATCH_SIZE == group; i++)
+            batch[subevents[i] % BATCH_SIZE] = bufs[i];
+        start = latency_start();
+        sign_message_batch(batch, group * BATCH_SIZE, ADVERTISER_KEY_ID);
+        latency_end(LATENCY_SIGN, start);
+    }
+#else
+    ARG_UNUSED(subevents);
+    start = latency_start();
+    sign_messages(bufs, count, ADVERTISER_KEY_ID);
+    latency_end(LATENCY_SIGN, start);
+#endif
+}
+
+static struct net_buf *pipeline_take(uint8_t subevent) {
+    struct net_buf *buf;
+    prepared_subevent_t *p;
+    atomic_val_t tail = atomic_get(&pipeline_tail);
+    atomic_val_t head = atomic_get(&pipeline_head);
+
+    if (tail != head) {
+        p = &pipeline[tail % CONFIG_SUBEVENT_PIPELINE_DEPTH];
+        if (p->subevent == subevent) {
+            buf = p->buf;
+            atomic_inc(&pipeline_tail);
+            k_sem_give(&pipeline_sem);
+            return buf;
         }
     }
+
+    // Drop whatever was prepared and restart the worker after this subevent
+    pipeline_drop((subevent + 1) % per_adv_params.num_subevents);
+    return NULL;
 }
 
-static void response_cb(struct bt_le_ext_adv *adv,
-                        struct bt_le_per_adv_response_info *info,
-                        struct net_buf_simple *buf) {
+/**
+ * \brief Drops every prepared subevent and restarts the worker at next.
+ * Only called from request_cb, the one consumer of the ring.
+ */
+static void pipeline_drop(uint8_t next) {
+    struct net_buf *dropped[CONFIG_SUBEVENT_PIPELINE_DEPTH];
+    size_t num_dropped = 0;
+    k_spinlock_key_t key;
+    atomic_val_t tail, head;
+
+    key = k_spin_lock(&pipeline_lock);
+    tail = atomic_get(&pipeline_tail);
+    head = atomic_get(&pipeline_head);
+    for (; tail != head; tail++)
+        dropped[num_dropped++] =
+            pipeline[tail % CONFIG_SUBEVENT_PIPELINE_DEPTH].buf;
+    atomic_set(&pipeline_tail, tail);
+    // The worker reads the generation before the resync point, so a run
+    // started with the new generation always starts at next
+    atomic_set(&pipeline_resync, next);
+    atomic_inc(&pipeline_gen);
+    k_spin_unlock(&pipeline_lock, key);
+
+    // Freeing may reschedule, which isn't allowed under a spinlock
+    for (size_t i = 0; i < num_dropped; i++)
+        net_buf_unref(dropped[i]);
+    k_sem_give(&pipeline_sem);
+}
+
+/**
+ * With CONFIG_ADV_SLOT_COMPACTION subevents without any reserved slot aren't
+ * sent. Subevent 0 is always sent since it drives the per event work.
+ */
+static bool subevent_dropped(uint8_t subevent) {
+    return IS_ENABLED(CONFIG_ADV_SLOT_COMPACTION) && subevent != 0 &&
+           slot_allocator_subevent_used(subevent) == 0;
+}
+
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+// A batch is built at once, so that it's signed under one tree
+#define PIPELINE_BUILD_COUNT BATCH_SIZE
+#define PIPELINE_RUN_END(next) ((next) % BATCH_SIZE == 0 || (next) == 0)
+BUILD_ASSERT(CONFIG_SUBEVENT_PIPELINE_DEPTH >= BATCH_SIZE,
+             "Subevent pipeline can't hold a signing batch");
+#else
+#define PIPELINE_BUILD_COUNT 1
+#define PIPELINE_RUN_END(next) false
+#endif // CONFIG_TRANSFER_BATCH_SIGNING
+
+/**
+ * \brief Builds subevents from next into up to free pipeline entries and
+ * signs them together.
+ * With CONFIG_TRANSFER_BATCH_SIGNING the run ends with the batch of next.
+ * Entries are filled past pipeline_head and published once signed, unless the
+ * ring was dropped since gen was read.
+ *
+ * \return Subevent following the run
+ */
+static uint8_t pipeline_build(uint8_t next, size_t free, atomic_val_t gen) {
+    struct net_buf_simple *bufs[CONFIG_SUBEVENT_PIPELINE_DEPTH];
+    uint8_t subevents[CONFIG_SUBEVENT_PIPELINE_DEPTH];
+    atomic_val_t head = atomic_get(&pipeline_head);
+    k_spinlock_key_t key;
+    size_t count = 0;
+    bool stale;
+
+    do {
+        if (next == 0)
+            event_start();
+        if (!subevent_dropped(next)) {
+            prepared_subevent_t *p =
+                &pipeline[(head + count) % CONFIG_SUBEVENT_PIPELINE_DEPTH];
+            // Worker holds at most CONFIG_SUBEVENT_PIPELINE_DEPTH buffers, so
+            // the rest of the pool is always left for request_cb
+            p->buf = net_buf_alloc(&subevent_tx_pool, K_FOREVER);
+            if (!prepare_subevent(next, &p->buf->b)) {
+                // Continues from next once the counter is committed
+                net_buf_unref(p->buf);
+                break;
+            }
+            p->subevent = next;
+            bufs[count] = &p->buf->b;
+            subevents[count++] = next;
+        }
+        next = (next + 1) % per_adv_params.num_subevents;
+    } while (count < free && !PIPELINE_RUN_END(next));
+
+    if (count == 0)
+        return next;
+
+    sign_subevents(bufs, subevents, count);
+    key = k_spin_lock(&pipeline_lock);
+    stale = atomic_get(&pipeline_gen) != gen;
+    if (!stale)
+        atomic_add(&pipeline_head, count);
+    k_spin_unlock(&pipeline_lock, key);
+
+    if (stale) {
+        // Entries past pipeline_head are still the worker's own
+        for (size_t i = 0; i < count; i++)
+            net_buf_unref(
+                pipeline[(head + i) % CONFIG_SUBEVENT_PIPELINE_DEPTH].buf);
+    }
+    return next;
+}
+
+static void pipeline_worker(void *p1, void *p2, void *p3) {
+    uint8_t next = 0;
+    atomic_val_t resync, gen;
+    size_t free;
+
+    for (;;) {
+        if (atomic_clear(&counter_commit_pending))
+            counter_commit();
+
+        // Generation first, a drop after reading it makes the run stale
+        gen = atomic_get(&pipeline_gen);
+        resync = atomic_set(&pipeline_resync, PIPELINE_IN_STEP);
+        if (resync != PIPELINE_IN_STEP)
+            next = resync;
+
+        free = CONFIG_SUBEVENT_PIPELINE_DEPTH -
+               (atomic_get(&pipeline_head) - atomic_get(&pipeline_tail));
+        if (free < PIPELINE_BUILD_COUNT) {
+            k_sem_take(&pipeline_sem, K_FOREVER);
+            continue;
+        }
+
+        next = pipeline_build(next, free, gen);
+    }
+}
+
+static rsp_filter_stage_t
+response_filter(const struct bt_le_per_adv_response_info *info,
+                const struct net_buf_simple *buf, uint16_t *sender_id) {
+    slot_data_t *slot = &rsp_slots[info->subevent][info->response_slot];
+    k_spinlock_key_t key;
+    uint64_t rsp_counter, newest, own;
+    bool plausible, has_id;
+
+    if (buf->len < response_header_len(buf) + COUNTER_WIRE_LEN + HASH_LEN) {
+        atomic_inc(&rsp_rejected[RSP_REJECT_LENGTH]);
+        LOG_DBG("message to short");
+        return RSP_REJECT_LENGTH;
+    }
+
+    // Sender id leads the response and stays readable to pick the key. With
+    // compact framing only a registering device sends it.
+    has_id = response_sender_id(buf, sender_id);
+    key = k_spin_lock(&slots_lock);
+    if (!has_id)
+        *sender_id = slot->dev_id;
+    plausible = *sender_id != 0 && *sender_id <= CONFIG_MAX_SCANNER_ID &&
+                (slot->dev_id == *sender_id ||
+                 (has_id && slot->dev_id == 0 &&
+                  slot->reg_idx != NO_REGISTER_SLOT));
+    k_spin_unlock(&slots_lock, key);
+    if (!plausible) {
+        atomic_inc(&rsp_rejected[RSP_REJECT_SLOT]);
+        LOG_DBG("Sender %d doesn't own sub: %d, slot: %d", *sender_id,
+                info->subevent, info->response_slot);
+        return RSP_REJECT_SLOT;
+    }
+
+    key = k_spin_lock(&counter_lock);
+    own = counter.value;
+    k_spin_unlock(&counter_lock, key);
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+    // Scanners keep up with the advertiser's counter, so a window that fell
+    // far behind is moved up to still expand the truncated counter right
+    if (own > RSP_COUNTER_MAX_AHEAD)
+        replay_window_raise(&device_windows[*sender_id],
+                            own - RSP_COUNTER_MAX_AHEAD);
+#endif
+    newest = MAX(device_windows[*sender_id].newest, own);
+    peek_message_counter(buf, response_header_len(buf),
+                         device_windows[*sender_id].newest, &rsp_counter);
+    if (replay_window_check(&device_windows[*sender_id], rsp_counter) !=
+            TRANSFER_NO_ERROR ||
+        rsp_counter > newest + RSP_COUNTER_MAX_AHEAD) {
+        atomic_inc(&rsp_rejected[RSP_REJECT_COUNTER]);
+        LOG_DBG("Counter %lld of sender %d out of range", rsp_counter,
+                *sender_id);
+        return RSP_REJECT_COUNTER;
+    }
+
+    return RSP_ACCEPTED;
+}
+
+static void response_handle(struct bt_le_ext_adv *adv,
+                            struct bt_le_per_adv_response_info *info,
+                            struct net_buf_simple *buf) {
     transfer_error_t transfer_err;
     response_data_t response;
-    struct net_buf_simple_state parse_state;
+    k_spinlock_key_t key;
+    replay_window_t window;
+    uint16_t sender_id, dev_id;
+    uint8_t reg_idx = NO_REGISTER_SLOT;
+    bool compact = false;
+    bool commit;
+    uint32_t start;
+
     if (buf) {
+        slot_data_t *slot = &rsp_slots[info->subevent][info->response_slot];
+
+        if (response_filter(info, buf, &sender_id) != RSP_ACCEPTED)
+            return;
+
         LOG_INF(INFO "Response: subevent %d, slot %d", info->subevent,
                 info->response_slot);
 
-        slot_data_t *slot = &rsp_slots[info->subevent][info->response_slot];
-
-        net_buf_simple_save(buf, &parse_state);
-        size_t to_save = HASH_LEN + sizeof(counter.value);
-        if (buf->len < to_save) {
-            LOG_WRN("message to short");
+        window = device_windows[sender_id];
+        start = latency_start();
+        transfer_err = verify_message_with_header(
+            buf, response_header_len(buf), MIN_SCANNER_KEY_ID + sender_id - 1,
+            &window);
+        latency_end(LATENCY_VERIFY, start);
+        if (transfer_err) {
+            // Anyone can send into a slot, so a forged response must not
+            // touch it. A device that really lost sync stops getting acked
+            // and its slot expires in prepare_subevent.
+            atomic_inc(&rsp_rejected[RSP_REJECT_MAC]);
+            LOG_WRN("FAILED to verify device, id: %d, err: %d", sender_id,
+                    transfer_err);
             return;
         }
-        net_buf_simple_remove_mem(buf, to_save);
 
         transfer_err = response_data_deserialize(&response, buf);
         if (transfer_err) {
@@ -201,69 +752,272 @@ static void response_cb(struct bt_le_ext_adv *adv,
             return;
         }
         current_rsp = response.rsp_metadata;
-
-        net_buf_simple_restore(buf, &parse_state);
-        transfer_err =
-            verify_message(buf, MIN_SCANNER_KEY_ID + current_rsp.sender_id - 1,
-                           &counter.value);
-        if (transfer_err) {
-            LOG_WRN("FAILED to verify device, id: %d, err: %d",
-                    current_rsp.sender_id, transfer_err);
-            slot->dev_id = 0;
-            register_data_t rd = (register_data_t){
-                .subevent = info->subevent, .rsp_slot = info->response_slot};
-            free_list_append(rd);
-            return;
-        }
-        if (set_adv_data() != 0) {
-            LOG_ERR("FAILED TO update adv data");
+        current_rsp.sender_id = sender_id;
+        device_windows[current_rsp.sender_id] = window;
+
+        // Scanners drop messages older than the newest counter they used, so
+        // the advertised counter still has to keep up with the fastest one.
+        // That may skip past the lease, which the worker then commits.
+        key = k_spin_lock(&counter_lock);
+        counter.value = MAX(counter.value, window.newest);
+        commit = crypto_secure_counter_sync(&counter);
+        k_spin_unlock(&counter_lock, key);
+        if (commit)
+            counter_commit_request();
+
+        key = k_spin_lock(&slots_lock);
+        dev_id = slot->dev_id;
+        if (dev_id == 0 && slot->reg_idx != NO_REGISTER_SLOT) {
+            slot_activate(info->subevent, info->response_slot,
+                          current_rsp.sender_id);
+            // Taken over in the same section, so the register slot is
+            // handed out once
+            reg_idx = slot->reg_idx;
+            slot->reg_idx = NO_REGISTER_SLOT;
+        } else if (dev_id == current_rsp.sender_id) {
+            compact = slot_allocator_should_compact(info->subevent);
+            if (compact)
+                slot_deactivate(info->subevent, info->response_slot);
+            else
+                slot->last_seen = subevent_events[info->subevent];
         }
+        k_spin_unlock(&slots_lock, key);
+
+        if (dev_id == 0) {
+            if (reg_idx == NO_REGISTER_SLOT) {
+                // Slot wasn't handed out, device will have to register again
+                LOG_WRN(INFO "Response in unreserved slot, sub: %d, slot: %d",
+                        info->subevent, info->response_slot);
+                return;
+            }
 
-        if (slot->dev_id == 0) {
-            // slot is empty -> register new device
+            // slot is a register slot -> register new device
             LOG_INF(INFO "New device registerd id: %d, sub: %d, slot: %d",
                     current_rsp.sender_id, info->subevent, info->response_slot);
-            slot->dev_id = current_rsp.sender_id;
-            slot->inactive_for = 0;
-
-            for (size_t i = 0; i < CONFIG_NUM_REGISTER_SLOTS; i++) {
-                if (info->subevent == register_subevent_data[i].subevent &&
-                    info->response_slot == register_subevent_data[i].rsp_slot) {
-                    register_subevent_data[i] = reserve_slot();
-                    break;
-                }
-            }
-            if (set_adv_data() != 0) {
-                LOG_ERR("FAILED TO update adv data");
-            }
 
+            register_slot_assign(reg_idx);
+            mark_adv_data_dirty();
             return;
-        } else if (slot->dev_id == current_rsp.sender_id) {
+        } else if (dev_id == current_rsp.sender_id) {
+            if (compact) {
+                // Not acking the device makes it register again, which moves
+                // it into a lower subevent
+                LOG_INF(INFO "Moving device %d out of subevent %d", dev_id,
+                        info->subevent);
+                slot_allocator_free((register_data_t){
+                    .subevent = info->subevent,
+                    .rsp_slot = info->response_slot});
+                return;
+            }
             // Got response from excepted sender
-            slot->inactive_for = 0;
-            LOG_INF(RECEIVED "%d, 1, %d, %d", slot->dev_id, info->rssi, current_rsp.counter);
+            LOG_INF(RECEIVED "%d, 1, %d, %llu", dev_id, info->rssi,
+                    window.newest);
             return;
         }
     }
 }
 
 static int set_adv_data() {
-    advertisement_data_t to_advertise = {.reg_data = register_subevent_data,
-                                         .selection_info = selection_data,
-                                         .counter = counter.value};
+    int ret;
+    register_data_t reg_data[CONFIG_NUM_REGISTER_SLOTS];
+    advertisement_data_t to_advertise = {.reg_data = reg_data,
+                                         .selection_info = selection_data};
+    uint32_t start = latency_start();
+    uint32_t sign_start;
+    k_spinlock_key_t key;
+
+    if (!message_counter(&adv_signed_counter, &to_advertise.counter))
+        return -EAGAIN;
+
+    // response_cb moves register slots meanwhile, so advertise a copy
+    key = k_spin_lock(&slots_lock);
+    memcpy(reg_data, register_subevent_data, sizeof(reg_data));
+    k_spin_unlock(&slots_lock, key);
+
+    // Called both from init and the pipeline worker
+    k_mutex_lock(&adv_data_mutex, K_FOREVER);
     net_buf_simple_reset(&adv_data);
     advertisement_data_serialize(&to_advertise, &adv_data);
+    sign_start = latency_start();
     sign_message(&adv_data, ADVERTISER_KEY_ID);
+    latency_end(LATENCY_SIGN, sign_start);
 
     const struct bt_data ad[] = {
         BT_DATA(BT_DATA_FLAGS, &adv_flags, sizeof(adv_flags)),
         BT_DATA(BT_DATA_MANUFACTURER_DATA, adv_data.data, adv_data.len),
     };
-    return bt_le_ext_adv_set_data(pawr_adv, ad, ARRAY_SIZE(ad), NULL, 0);
+    ret = bt_le_ext_adv_set_data(pawr_adv, ad, ARRAY_SIZE(ad), NULL, 0);
+    if (ret == 0)
+        adv_data_counter = to_advertise.counter;
+    k_mutex_unlock(&adv_data_mutex);
+    latency_end(LATENCY_SET_ADV_DATA, start);
+    return ret;
+}
+
+static void mark_adv_data_dirty() {
+    if (atomic_set(&adv_data_dirty, true))
+        atomic_inc(&adv_updates_skipped);
+}
+
+/**
+ * \brief Pushes adv data if it changed.
+ * Called once per periodic event from event_start. Adv data is rebuilt
+ * only if a register slot was consumed or the advertised counter fell
+ * CONFIG_ADV_DATA_COUNTER_WINDOW behind.
+ */
+static void refresh_adv_data() {
+    uint64_t current = counter_peek();
+
+    if (!atomic_clear(&adv_data_dirty) &&
+        current - adv_data_counter < CONFIG_ADV_DATA_COUNTER_WINDOW) {
+        atomic_inc(&adv_updates_skipped);
+        return;
+    }
+
+    if (set_adv_data() != 0) {
+        LOG_ERR("Couldn't update adv data");
+        atomic_set(&adv_data_dirty, true);
+    }
 }
 
 // FSM definitions
 
+/**
+ * \brief Reserves a new counter lease.
+ * The journal write goes to flash, so it works on a copy of the counter and
+ * doesn't hold counter_lock meanwhile. Every commit goes through here, so
+ * counter_commit_mutex keeps the worker's and the reboot paths' journal writes
+ * apart.
+ */
+static void counter_commit() {
+    crypto_counter_t snapshot;
+    k_spinlock_key_t key;
+    psa_status_t err;
+
+    k_mutex_lock(&counter_commit_mutex, K_FOREVER);
+    key = k_spin_lock(&counter_lock);
+    snapshot = counter;
+    k_spin_unlock(&counter_lock, key);
+
+    err = crypto_secure_counter_commit(&snapshot);
+    if (err != PSA_SUCCESS) {
+        LOG_ERR(INFO "Failed to commit counter (err %d)", err);
+    } else {
+        key = k_spin_lock(&counter_lock);
+        counter.reserved = snapshot.reserved;
+        counter.seq = snapshot.seq;
+        k_spin_unlock(&counter_lock, key);
+    }
+    k_mutex_unlock(&counter_commit_mutex);
+}
+
+/**
+ * \brief Has the pipeline worker commit the counter.
+ * For the callbacks, which can't wait for the flash write.
+ */
+static void counter_commit_request() {
+    atomic_set(&counter_commit_pending, true);
+    k_sem_give(&pipeline_sem);
+}
+
+/**
+ * \brief Work done once per periodic event, before subevent 0 is built.
+ * Only called from the pipeline worker, subevents request_cb builds inline
+ * use the adv data as it is and take a fresh counter from message_counter. An event whose subevent 0 was
+ * built more than once is only started once.
+ */
+static void event_start() {
+    k_spinlock_key_t key;
+    uint16_t event;
+    bool commit;
+
+    key = k_spin_lock(&slots_lock);
+    event = subevent_events[0] + 1;
+    k_spin_unlock(&slots_lock, key);
+    if (event == event_started)
+        return;
+    event_started = event;
+
+    register_slots_refill();
+    refresh_adv_data();
+    key = k_spin_lock(&counter_lock);
+    commit = crypto_secure_counter_advance(&counter);
+    k_spin_unlock(&counter_lock, key);
+    if (commit)
+        counter_commit();
+}
+
+/**
+ * \brief Counter value for the next signed message.
+ * With an AEAD authenticator the counter is the nonce, so every message takes
+ * a new value instead of all messages of a periodic event sharing one. The
+ * counter is also advanced when its value isn't newer than the last one
+ * signed for the same scanners, which happens for subevents built inline
+ * before event_start and for adv data. The commit that may need is left to the
+ * pipeline worker.
+ *
+ * \param last adv_signed_counter or an entry of subevent_signed_counters,
+ * updated to value
+ * \return false if value is past the persisted bound, nothing may be signed
+ * with it until the worker committed the counter
+ */
+static bool message_counter(uint64_t *last, uint64_t *value) {
+    k_spinlock_key_t key;
+    bool commit = false;
+    bool persisted;
+    uint64_t floor;
+
+    key = k_spin_lock(&counter_lock);
+    // Adv data reaches every scanner, a subevent only its own and adv data's
+    floor = last == &adv_signed_counter ? newest_signed_counter
+                                        : MAX(*last, adv_signed_counter);
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM) || counter.value <= floor) {
+        counter.value = MAX(counter.value, floor);
+        commit = crypto_secure_counter_advance(&counter);
+    }
+    *value = counter.value;
+    persisted = counter.value < counter.reserved;
+    if (persisted) {
+        *last = counter.value;
+        newest_signed_counter = MAX(newest_signed_counter, counter.value);
+    }
+    k_spin_unlock(&counter_lock, key);
+
+    if (commit || !persisted)
+        counter_commit_request();
+    return persisted;
+}
+
+/**
+ * \brief Counter value without advancing it.
+ */
+static uint64_t counter_peek() {
+    k_spinlock_key_t key;
+    uint64_t value;
+
+    key = k_spin_lock(&counter_lock);
+    value = counter.value;
+    k_spin_unlock(&counter_lock, key);
+    return value;
+}
+
+/**
+ * \brief Derives the deadline of each timed stage from the PAwR timing.
+ * The controller asks for a subevent's data one subevent ahead, and a response
+ * has to be handled before the one of the next slot arrives. Signing and adv
+ * data updates may run inline in request_cb, so they share its deadline.
+ */
+static void latency_deadlines_set() {
+    uint32_t subevent_us = per_adv_params.subevent_interval * 1250;
+    uint32_t rsp_slot_us = per_adv_params.response_slot_spacing * 125;
+
+    latency_set_deadline(LATENCY_REQUEST_CB, subevent_us);
+    latency_set_deadline(LATENCY_SET_ADV_DATA, subevent_us);
+    latency_set_deadline(LATENCY_SIGN, subevent_us);
+    latency_set_deadline(LATENCY_RESPONSE_CB, rsp_slot_us);
+    latency_set_deadline(LATENCY_VERIFY, rsp_slot_us);
+}
+
 static state_t init() {
     int err;
     psa_status_t psa_err;
@@ -280,11 +1034,24 @@ static state_t init() {
     if (psa_err != PSA_SUCCESS)
         return FAULT_HANDLING;
 
+#if defined(CONFIG_CRYPTO_SIM_KEYS)
+    // Simulated devices derive their keys instead of having them flashed
+    psa_err = crypto_sim_key_import(ADVERTISER_KEY_ID, 0);
+    for (uint16_t id = 1;
+         id <= CONFIG_MAX_SCANNER_ID && psa_err == PSA_SUCCESS; id++)
+        psa_err = crypto_sim_key_import(MIN_SCANNER_KEY_ID + id - 1, id);
+    if (psa_err != PSA_SUCCESS) {
+        LOG_ERR(INFO "Failed to import simulation keys (err %d)", psa_err);
+        return FAULT_HANDLING;
+    }
+#endif // CONFIG_CRYPTO_SIM_KEYS
+
     psa_err = crypto_secure_counter_init(&counter);
     if (psa_err != PSA_SUCCESS)
         return FAULT_HANDLING;
 
     LOG_INF(INFO "Starting advertiser, courrent counter %lld", counter.value);
+    init_device_counters(counter.value);
 
     err = bt_enable(NULL);
     if (err) {
@@ -308,6 +1075,8 @@ static state_t init() {
     }
 
     selection_data.num_reg_slots = CONFIG_NUM_REGISTER_SLOTS;
+    if (IS_ENABLED(CONFIG_ADV_LATENCY))
+        latency_deadlines_set();
 
     err = set_adv_data();
     if (err) {
@@ -315,6 +1084,12 @@ static state_t init() {
         return FAULT_HANDLING;
     }
 
+    k_thread_create(&pipeline_thread, pipeline_stack,
+                    K_THREAD_STACK_SIZEOF(pipeline_stack), pipeline_worker,
+                    NULL, NULL, NULL, CONFIG_SUBEVENT_PIPELINE_PRIORITY, 0,
+                    K_NO_WAIT);
+    k_thread_name_set(&pipeline_thread, "subevent_pipeline");
+
     err = bt_le_per_adv_start(pawr_adv);
     if (err) {
         LOG_ERR("Failed to enable periodic advertising (err %d)", err);
@@ -334,20 +1109,35 @@ static state_t init() {
 
 static state_t advertising() {
     while (k_sem_take(&reboot_sem, K_SECONDS(10)) != 0) {
-        LOG_INF(INFO "Still alive");
+        LOG_INF(INFO "Still alive, subevents prebuilt: %ld, built inline: %ld, "
+                     "adv updates skipped: %ld",
+                atomic_get(&pipeline_prebuilt), atomic_get(&pipeline_inline),
+                atomic_get(&adv_updates_skipped));
+        LOG_INF(INFO "Responses rejected, length: %ld, slot: %ld, "
+                     "counter: %ld, mac: %ld",
+                atomic_get(&rsp_rejected[RSP_REJECT_LENGTH]),
+                atomic_get(&rsp_rejected[RSP_REJECT_SLOT]),
+                atomic_get(&rsp_rejected[RSP_REJECT_COUNTER]),
+                atomic_get(&rsp_rejected[RSP_REJECT_MAC]));
+        if (IS_ENABLED(CONFIG_ADV_LATENCY_LOG))
+            latency_log();
     }
     return SOFT_REBOOT;
 }
 
 static state_t fault_handling() {
-    crypto_secure_counter_commit(&counter);
+    counter_commit();
+    if (IS_ENABLED(CONFIG_ADV_CAPTURE))
+        capture_dump();
     LOG_ERR(INFO "Received a fault rebooting");
     sys_reboot(SYS_REBOOT_COLD);
 }
 
 static state_t soft_reboot() {
     LOG_INF("Reboot requested, saving counter and rebooting");
-    crypto_secure_counter_commit(&counter);
+    counter_commit();
+    if (IS_ENABLED(CONFIG_ADV_CAPTURE))
+        capture_dump();
     sys_reboot(SYS_REBOOT_COLD);
 }
 
@@ -364,37 +1154,77 @@ static const char *state_str(state_t s) {
     }
 }
 
-static register_data_t reserve_slot() {
-    register_data_t ret;
+static void slot_activate(uint8_t subevent, uint8_t rsp_slot,
+                          uint16_t dev_id) {
+    slot_data_t *slot = &rsp_slots[subevent][rsp_slot];
 
-    if (free_list_pop(&ret) == 0)
-        return ret;
+    slot->dev_id = dev_id;
+    slot->last_seen = subevent_events[subevent];
+    active_slots[subevent][rsp_slot / 32] |= BIT(rsp_slot % 32);
+}
 
-    k_mutex_lock(&reserve_mutex, K_FOREVER);
+static void slot_deactivate(uint8_t subevent, uint8_t rsp_slot) {
+    rsp_slots[subevent][rsp_slot].dev_id = 0;
+    active_slots[subevent][rsp_slot / 32] &= ~BIT(rsp_slot % 32);
+}
 
-    memcpy(&ret, &last_used, sizeof(ret));
+static void register_slot_assign(uint8_t reg_idx) {
+    register_data_t sel_slot;
+    k_spinlock_key_t key;
 
-    if (last_used.rsp_slot + 1 == NUM_RSP_SLOTS) {
-        last_used.subevent++;
-        last_used.rsp_slot = 0;
-    } else {
-        last_used.rsp_slot++;
+    if (slot_allocator_alloc(&sel_slot) != 0) {
+        LOG_ERR(INFO "No free slot left for register slot %d", reg_idx);
+        atomic_set_bit(register_slots_stale, reg_idx);
+        return;
     }
+    key = k_spin_lock(&slots_lock);
+    register_subevent_data[reg_idx] = sel_slot;
+    rsp_slots[sel_slot.subevent][sel_slot.rsp_slot].reg_idx = reg_idx;
+    k_spin_unlock(&slots_lock, key);
+}
 
-    k_mutex_unlock(&reserve_mutex);
+/**
+ * \brief Moves stale register slots to slots freed since.
+ * Called once per periodic event, before adv data is refreshed.
+ */
+static void register_slots_refill() {
+    for (uint8_t i = 0; i < CONFIG_NUM_REGISTER_SLOTS; i++) {
+        // Still full, don't log every stale slot again
+        if (slot_allocator_total_used() == SLOT_COUNT)
+            return;
+        if (!atomic_test_and_clear_bit(register_slots_stale, i))
+            continue;
+        register_slot_assign(i);
+        if (!atomic_test_bit(register_slots_stale, i))
+            mark_adv_data_dirty();
+    }
+}
 
-    return ret;
+/**
+ * \brief Starts every device at the restored advertiser counter.
+ * The advertised counter was never behind an accepted response, so responses
+ * sent before the reboot can't be replayed.
+ */
+static void init_device_counters(uint64_t value) {
+    for (size_t i = 0; i < ARRAY_SIZE(device_windows); i++)
+        replay_window_init(&device_windows[i], value);
 }
 
 void init_bufs(void) {
-    for (size_t i = 0; i < CONFIG_NUM_REGISTER_SLOTS; i++) {
-        register_data_t sel_slot = reserve_slot();
-        register_subevent_data[i] = sel_slot;
-    }
+    slot_allocator_init();
     for (size_t i = 0; i < MAX_NUM_SUBEVENTS; i++) {
-        net_buf_simple_init_with_data(&bufs[i], &backing_store[i],
-                                      TO_SEND_BUF_SIZE);
+        for (size_t j = 0; j < NUM_RSP_SLOTS; j++) {
+            rsp_slots[i][j].reg_idx = NO_REGISTER_SLOT;
+        }
+    }
+    for (size_t i = 0; i < CONFIG_NUM_REGISTER_SLOTS; i++) {
+        register_slot_assign(i);
     }
+    LOG_INF(INFO "Subevent TX pool: %d x %d B = %d B (%d B for all %d "
+                 "subevents)",
+            SUBEVENT_TX_BUF_COUNT, TO_SEND_BUF_SIZE,
+            SUBEVENT_TX_BUF_COUNT * TO_SEND_BUF_SIZE,
+            MAX_NUM_SUBEVENTS * TO_SEND_BUF_SIZE, MAX_NUM_SUBEVENTS);
 }
 
 static state_t run_state() { return states[curr_state](); }
@@ -25,7 +25,9 @@
 #include <app/lib/crypto.h>
 
 #include "advertiser_fsm.h"
-#include "free_list.h"
+#include "capture.h"
+#include "latency.h"
+#include "slot_allocator.h"
 
 #ifdef CONFIG_INTERACTIVE
 #include <app/lib/interactive.h>
@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include <app/lib/crypto.h>
+
+#include "capture.h"
+#include "slot_allocator.h"
+
+#define CAPTURE_SIZE CONFIG_ADV_CAPTURE_BUF_SIZE
+/** Bytes of the image printed per console line */
+#define DUMP_LINE_LEN 32
+
+BUILD_ASSERT(CAPTURE_SIZE >= sizeof(capture_record_t) + UINT8_MAX,
+             "Capture can't hold a full length response");
+
+/**
+ * \brief Records back to back, wrapping around the end of ring.
+ * The oldest record starts at ring_start, ring_used bytes are taken. Records
+ * are only ever dropped or taken whole.
+ */
+static uint8_t ring[CAPTURE_SIZE];
+static size_t ring_start;
+static size_t ring_used;
+static uint32_t dropped;
+static struct k_spinlock capture_lock;
+
+/**
+ * \brief Copies len bytes to offset bytes past the oldest record.
+ */
+static void ring_write(size_t offset, const void *src, size_t len) {
+    size_t pos = (ring_start + offset) % CAPTURE_SIZE;
+    size_t first = MIN(len, CAPTURE_SIZE - pos);
+
+    memcpy(&ring[pos], src, first);
+    memcpy(ring, (const uint8_t *)src + first, len - first);
+}
+
+static void ring_read(size_t offset, void *dst, size_t len) {
+    size_t pos = (ring_start + offset) % CAPTURE_SIZE;
+    size_t first = MIN(len, CAPTURE_SIZE - pos);
+
+    memcpy(dst, &ring[pos], first);
+    memcpy((uint8_t *)dst + first, ring, len - first);
+}
+
+/**
+ * \return Length of the oldest record and its data, 0 if there is none
+ */
+static size_t ring_peek_len() {
+    capture_record_t record;
+
+    if (ring_used == 0)
+        return 0;
+    ring_read(0, &record, sizeof(record));
+    return sizeof(record) + record.len;
+}
+
+static void ring_drop(size_t len) {
+    ring_start = (ring_start + len) % CAPTURE_SIZE;
+    ring_used -= len;
+}
+
+static void capture_put(capture_record_t *record, const uint8_t *data) {
+    size_t len = sizeof(*record) + record->len;
+    k_spinlock_key_t key;
+
+    record->timestamp = k_ticks_to_us_floor32(k_uptime_ticks());
+
+    key = k_spin_lock(&capture_lock);
+    while (IS_ENABLED(CONFIG_ADV_CAPTURE_OVERWRITE) &&
+           CAPTURE_SIZE - ring_used < len) {
+        ring_drop(ring_peek_len());
+        dropped++;
+    }
+    if (CAPTURE_SIZE - ring_used < len) {
+        dropped++;
+    } else {
+        ring_write(ring_used, record, sizeof(*record));
+        if (record->len > 0)
+            ring_write(ring_used + sizeof(*record), data, record->len);
+        ring_used += len;
+    }
+    k_spin_unlock(&capture_lock, key);
+}
+
+void capture_request(const struct bt_le_per_adv_data_request *request,
+                     uint64_t counter) {
+    capture_record_t record = {
+        .counter = counter,
+        .type = CAPTURE_REQUEST,
+        .subevent = request->start,
+        .slot = request->count,
+    };
+
+    capture_put(&record, NULL);
+}
+
+void capture_response(const struct bt_le_per_adv_response_info *info,
+                      const struct net_buf_simple *buf, uint64_t counter) {
+    capture_record_t record = {
+        .counter = counter,
+        .type = buf ? CAPTURE_RESPONSE : CAPTURE_RESPONSE_LOST,
+        .subevent = info->subevent,
+        .slot = info->response_slot,
+        .rssi = info->rssi,
+        .len = buf ? MIN(buf->len, UINT8_MAX) : 0,
+    };
+
+    capture_put(&record, buf ? buf->data : NULL);
+}
+
+void capture_header(capture_header_t *header) {
+    k_spinlock_key_t key;
+
+    *header = (capture_header_t){
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+        .num_subevents = MAX_NUM_SUBEVENTS,
+        .num_rsp_slots = NUM_RSP_SLOTS,
+        .num_register_slots = CONFIG_NUM_REGISTER_SLOTS,
+        .hash_len = HASH_LEN,
+    };
+    key = k_spin_lock(&capture_lock);
+    header->dropped = dropped;
+    k_spin_unlock(&capture_lock, key);
+}
+
+size_t capture_take(uint8_t *dst, size_t len) {
+    k_spinlock_key_t key;
+    size_t taken = 0;
+    size_t record_len;
+
+    key = k_spin_lock(&capture_lock);
+    for (;;) {
+        record_len = ring_peek_len();
+        if (record_len == 0 || taken + record_len > len)
+            break;
+        ring_read(0, &dst[taken], record_len);
+        ring_drop(record_len);
+        taken += record_len;
+    }
+    k_spin_unlock(&capture_lock, key);
+    return taken;
+}
+
+static void dump_hex(const uint8_t *data, size_t len) {
+    char line[2 * DUMP_LINE_LEN + 1];
+    size_t chunk;
+
+    for (size_t i = 0; i < len; i += chunk) {
+        chunk = MIN(len - i, DUMP_LINE_LEN);
+        bin2hex(&data[i], chunk, line, sizeof(line));
+        printk("CAP,%s\n", line);
+    }
+}
+
+size_t capture_dump(void) {
+    uint8_t chunk[sizeof(capture_record_t) + UINT8_MAX];
+    const capture_record_t *record;
+    capture_header_t header;
+    size_t records = 0;
+    size_t len;
+
+    capture_header(&header);
+    printk("CAP,start\n");
+    dump_hex((const uint8_t *)&header, sizeof(header));
+    // The callbacks may still be adding records, stop after a capture's worth
+    for (size_t total = 0; total < CAPTURE_SIZE; total += len) {
+        len = capture_take(chunk, sizeof(chunk));
+        if (len == 0)
+            break;
+        dump_hex(chunk, len);
+        for (size_t i = 0; i < len; i += sizeof(*record) + record->len) {
+            record = (const capture_record_t *)&chunk[i];
+            records++;
+        }
+    }
+    printk("CAP,end\n");
+    return records;
+}
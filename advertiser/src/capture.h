@@ -0,0 +1,87 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/net_buf.h>
+#include <zephyr/toolchain.h>
+
+/** "PAWR" read as a little endian word */
+#define CAPTURE_MAGIC 0x52574150
+#define CAPTURE_VERSION 1
+
+typedef enum {
+    CAPTURE_REQUEST,
+    CAPTURE_RESPONSE,
+    /** Response the controller failed to receive, passed on without data */
+    CAPTURE_RESPONSE_LOST,
+} capture_type_t;
+
+/**
+ * \brief Start of a capture image, followed by the records oldest first.
+ * Header and records are stored in the byte order of the advertiser, which
+ * is little endian on both the nRF54 and native_sim.
+ */
+typedef struct __packed {
+    uint32_t magic;
+    uint8_t version;
+    /** Advertiser build the capture was taken with */
+    uint8_t num_subevents;
+    uint8_t num_rsp_slots;
+    uint8_t num_register_slots;
+    uint8_t hash_len;
+    /** Records lost because the capture was full */
+    uint32_t dropped;
+} capture_header_t;
+
+/**
+ * \brief One callback invocation, a response is followed by len bytes of data.
+ */
+typedef struct __packed {
+    /** Uptime in us when the callback ran, wraps after 71 minutes */
+    uint32_t timestamp;
+    /** Advertiser counter when the callback ran */
+    uint64_t counter;
+    uint8_t type;
+    /** First subevent requested, or subevent of the response */
+    uint8_t subevent;
+    /** Number of subevents requested, or response slot */
+    uint8_t slot;
+    int8_t rssi;
+    uint8_t len;
+} capture_record_t;
+
+/**
+ * \brief Records a data request.
+ * Safe to call from any thread, never blocks.
+ */
+void capture_request(const struct bt_le_per_adv_data_request *request,
+                     uint64_t counter);
+/**
+ * \brief Records a response, buf may be NULL if the controller lost it.
+ * Safe to call from any thread, never blocks.
+ */
+void capture_response(const struct bt_le_per_adv_response_info *info,
+                      const struct net_buf_simple *buf, uint64_t counter);
+/**
+ * \brief Fills in the header of an image of the current capture.
+ */
+void capture_header(capture_header_t *header);
+/**
+ * \brief Moves the oldest records out of the capture, as many whole records
+ * as fit into len bytes.
+ *
+ * \return Number of bytes written to dst
+ */
+size_t capture_take(uint8_t *dst, size_t len);
+/**
+ * \brief Prints the capture image as hex to the console and empties it.
+ * Each line is "CAP,<hex>", between a "CAP,start" and a "CAP,end" line.
+ * tests/advertiser/replay/capture.py turns the lines back into a file.
+ *
+ * \return Number of records printed
+ */
+size_t capture_dump(void);
+
+#endif // CAPTURE_H
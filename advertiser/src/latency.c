@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#ifdef CONFIG_ADV_LATENCY_SHELL
+#include <zephyr/shell/shell.h>
+#endif // CONFIG_ADV_LATENCY_SHELL
+
+#include "latency.h"
+
+LOG_MODULE_REGISTER(latency, LOG_LEVEL_INF);
+
+/**
+ * Bucket 0 counts calls that took no cycle, bucket n > 0 the ones that took
+ * from 2^(n-1) up to 2^n - 1 cycles.
+ */
+#define LATENCY_BUCKETS 33
+
+/**
+ * \brief Histogram of one stage.
+ * Everything is updated with atomics only, so a stage can be timed from the
+ * Bluetooth callbacks and the pipeline worker at once without taking a lock.
+ */
+typedef struct {
+    atomic_t buckets[LATENCY_BUCKETS];
+    atomic_t max_cycles;
+    atomic_t misses;
+    /** 0 if the stage has no deadline */
+    uint32_t deadline_cycles;
+} latency_hist_t;
+
+static const char *const stage_names[LATENCY_STAGES] = {
+    [LATENCY_REQUEST_CB] = "request_cb",
+    [LATENCY_RESPONSE_CB] = "response_cb",
+    [LATENCY_SET_ADV_DATA] = "set_adv_data",
+    [LATENCY_SIGN] = "sign_message",
+    [LATENCY_VERIFY] = "verify_message",
+};
+
+static latency_hist_t hists[LATENCY_STAGES];
+
+void latency_add(latency_stage_t stage, uint32_t cycles) {
+    latency_hist_t *hist = &hists[stage];
+    atomic_val_t max;
+
+    atomic_inc(&hist->buckets[find_msb_set(cycles)]);
+    if (hist->deadline_cycles != 0 && cycles > hist->deadline_cycles)
+        atomic_inc(&hist->misses);
+
+    do {
+        max = atomic_get(&hist->max_cycles);
+    } while ((uint32_t)max < cycles &&
+             !atomic_cas(&hist->max_cycles, max, cycles));
+}
+
+void latency_set_deadline(latency_stage_t stage, uint32_t us) {
+    hists[stage].deadline_cycles = k_us_to_cyc_ceil32(us);
+}
+
+/**
+ * \return Upper bound in us of the bucket holding the permille'th call
+ */
+static uint32_t percentile_us(const uint32_t buckets[LATENCY_BUCKETS],
+                              uint32_t calls, uint32_t permille) {
+    uint64_t target = DIV_ROUND_UP((uint64_t)calls * permille, 1000);
+    uint64_t seen = 0;
+    uint8_t i;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= MAX(target, 1))
+            break;
+    }
+    return k_cyc_to_us_ceil32(BIT64(i) - 1);
+}
+
+void latency_summary(latency_stage_t stage, latency_summary_t *summary) {
+    const latency_hist_t *hist = &hists[stage];
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t calls = 0;
+
+    // Calls are counted from the buckets, so that the percentiles add up
+    // even if a stage finishes while they are copied
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        buckets[i] = atomic_get(&hist->buckets[i]);
+        calls += buckets[i];
+    }
+
+    *summary = (latency_summary_t){
+        .name = stage_names[stage],
+        .calls = calls,
+        .max_us = k_cyc_to_us_ceil32(atomic_get(&hist->max_cycles)),
+        .deadline_us = k_cyc_to_us_floor32(hist->deadline_cycles),
+        .misses = atomic_get(&hist->misses),
+    };
+    if (calls == 0)
+        return;
+    summary->p50_us = MIN(percentile_us(buckets, calls, 500), summary->max_us);
+    summary->p90_us = MIN(percentile_us(buckets, calls, 900), summary->max_us);
+    summary->p99_us = MIN(percentile_us(buckets, calls, 990), summary->max_us);
+}
+
+void latency_reset(void) {
+    for (size_t s = 0; s < LATENCY_STAGES; s++) {
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+            atomic_clear(&hists[s].buckets[i]);
+        atomic_clear(&hists[s].max_cycles);
+        atomic_clear(&hists[s].misses);
+    }
+}
+
+void latency_log(void) {
+    latency_summary_t summary;
+
+    for (size_t s = 0; s < LATENCY_STAGES; s++) {
+        latency_summary(s, &summary);
+        if (summary.calls == 0)
+            continue;
+        LOG_INF("%s: calls %u, p50 %u us, p90 %u us, p99 %u us, max %u us, "
+                "deadline %u us, misses %u",
+                summary.name, summary.calls, summary.p50_us, summary.p90_us,
+                summary.p99_us, summary.max_us, summary.deadline_us,
+                summary.misses);
+    }
+}
+
+#ifdef CONFIG_ADV_LATENCY_SHELL
+static int cmd_latency_dump(const struct shell *sh, size_t argc,
+                            char **argv) {
+    latency_summary_t summary;
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    shell_print(sh, "stage,calls,p50_us,p90_us,p99_us,max_us,deadline_us,"
+                    "misses");
+    for (size_t s = 0; s < LATENCY_STAGES; s++) {
+        latency_summary(s, &summary);
+        shell_print(sh, "%s,%u,%u,%u,%u,%u,%u,%u", summary.name,
+                    summary.calls, summary.p50_us, summary.p90_us,
+                    summary.p99_us, summary.max_us, summary.deadline_us,
+                    summary.misses);
+        if (!verbose)
+            continue;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            uint32_t count = atomic_get(&hists[s].buckets[i]);
+
+            if (count > 0)
+                shell_print(sh, "  <= %u us: %u",
+                            k_cyc_to_us_ceil32(BIT64(i) - 1), count);
+        }
+    }
+    return 0;
+}
+
+static int cmd_latency_reset(const struct shell *sh, size_t argc,
+                             char **argv) {
+    latency_reset();
+    shell_print(sh, "latency histograms reset");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    latency_cmds,
+    SHELL_CMD_ARG(dump, NULL,
+                  "Print the latency of each stage, -v adds the buckets",
+                  cmd_latency_dump, 1, 1),
+    SHELL_CMD(reset, NULL, "Empty the latency histograms", cmd_latency_reset),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(adv_latency, &latency_cmds,
+                   "Advertiser hot path latency histograms", NULL);
+#endif // CONFIG_ADV_LATENCY_SHELL
@@ -0,0 +1,78 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+/**
+ * \brief Timed stages of the advertiser hot path.
+ * The sign stage covers one signing call, which signs all subevents built
+ * together or the adv data.
+ */
+typedef enum {
+    LATENCY_REQUEST_CB,
+    LATENCY_RESPONSE_CB,
+    LATENCY_SET_ADV_DATA,
+    LATENCY_SIGN,
+    LATENCY_VERIFY,
+    LATENCY_STAGES
+} latency_stage_t;
+
+/**
+ * \brief Histogram of a stage reduced to what gets printed, times in us.
+ * Percentiles are the upper bound of their bucket, so at most twice the
+ * exact value.
+ */
+typedef struct {
+    const char *name;
+    uint32_t calls;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    /** 0 if the stage has no deadline */
+    uint32_t deadline_us;
+    /** Calls that took longer than the deadline */
+    uint32_t misses;
+} latency_summary_t;
+
+void latency_add(latency_stage_t stage, uint32_t cycles);
+
+/**
+ * \brief Cycle count to pass to latency_end, 0 without CONFIG_ADV_LATENCY.
+ */
+static inline uint32_t latency_start(void) {
+    return IS_ENABLED(CONFIG_ADV_LATENCY) ? k_cycle_get_32() : 0;
+}
+
+/**
+ * \brief Adds the cycles since start to the histogram of stage.
+ * Compiles to nothing without CONFIG_ADV_LATENCY.
+ */
+static inline void latency_end(latency_stage_t stage, uint32_t start) {
+    if (IS_ENABLED(CONFIG_ADV_LATENCY))
+        latency_add(stage, k_cycle_get_32() - start);
+}
+
+/**
+ * \brief Sets the time a stage has before the controller needs its result.
+ * Calls taking longer are counted as misses.
+ */
+void latency_set_deadline(latency_stage_t stage, uint32_t us);
+/**
+ * \brief Summarizes the histogram of stage.
+ * Safe to call while the stage is being timed, the summary may then be off by
+ * the calls that ran meanwhile.
+ */
+void latency_summary(latency_stage_t stage, latency_summary_t *summary);
+/**
+ * \brief Empties all histograms, deadlines are kept.
+ */
+void latency_reset(void);
+/**
+ * \brief Logs the summary of every stage that ran.
+ */
+void latency_log(void);
+
+#endif // LATENCY_H
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "slot_allocator.h"
+
+#define SLOT_WORDS ATOMIC_BITMAP_SIZE(SLOT_COUNT)
+#define SUMMARY_WORDS ATOMIC_BITMAP_SIZE(SLOT_WORDS)
+
+/**
+ * \brief Free slots, bit n is set when slot n is free.
+ * Slot n is rsp_slot n % NUM_RSP_SLOTS of subevent n / NUM_RSP_SLOTS. Bit w of
+ * summary is set when word w of free_slots may have a free slot, so finding
+ * the lowest free slot takes two find-first-set lookups.
+ *
+ * Everything is updated with atomics only, so alloc and free can be called
+ * from the Bluetooth callbacks and the pipeline worker at the same time
+ * without ever waiting on each other.
+ */
+static atomic_t free_slots[SLOT_WORDS];
+static atomic_t summary[SUMMARY_WORDS];
+
+static atomic_t subevent_used[MAX_NUM_SUBEVENTS];
+static atomic_t total_used;
+
+static inline uint8_t lowest_bit(atomic_val_t v) {
+    return __builtin_ctzl((unsigned long)v);
+}
+
+/**
+ * \brief Clears summary bit of word, unless a slot in it got freed in the
+ * meantime.
+ * Free sets the slot bit before the summary bit, so checking the word again
+ * after clearing can't lose a free.
+ */
+static void summary_clear(size_t word) {
+    atomic_clear_bit(summary, word);
+    if (atomic_get(&free_slots[word]) != 0)
+        atomic_set_bit(summary, word);
+}
+
+/**
+ * \brief Takes the lowest free slot in word.
+ *
+ * \return slot index, -1 if the word is empty
+ */
+static int32_t word_take(size_t word) {
+    atomic_val_t old, new;
+
+    do {
+        old = atomic_get(&free_slots[word]);
+        if (old == 0)
+            return -1;
+        new = old & (old - 1);
+    } while (!atomic_cas(&free_slots[word], old, new));
+
+    if (new == 0)
+        summary_clear(word);
+
+    return word * ATOMIC_BITS + lowest_bit(old);
+}
+
+void slot_allocator_init(void) {
+    for (size_t i = 0; i < SLOT_WORDS; i++)
+        atomic_clear(&free_slots[i]);
+    for (size_t i = 0; i < SUMMARY_WORDS; i++)
+        atomic_clear(&summary[i]);
+
+    for (size_t i = 0; i < SLOT_COUNT; i++) {
+        atomic_set_bit(free_slots, i);
+        atomic_set_bit(summary, i / ATOMIC_BITS);
+    }
+    for (size_t i = 0; i < MAX_NUM_SUBEVENTS; i++)
+        atomic_clear(&subevent_used[i]);
+    atomic_clear(&total_used);
+}
+
+int8_t slot_allocator_alloc(register_data_t *slot) {
+    atomic_val_t s;
+    size_t word;
+    int32_t n;
+
+    for (size_t i = 0; i < SUMMARY_WORDS; i++) {
+        while ((s = atomic_get(&summary[i])) != 0) {
+            word = i * ATOMIC_BITS + lowest_bit(s);
+            n = word_take(word);
+            if (n < 0) {
+                // Stale summary bit, word got emptied by someone else
+                summary_clear(word);
+                continue;
+            }
+
+            slot->subevent = n / NUM_RSP_SLOTS;
+            slot->rsp_slot = n % NUM_RSP_SLOTS;
+            atomic_inc(&subevent_used[slot->subevent]);
+            atomic_inc(&total_used);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void slot_allocator_free(register_data_t slot) {
+    uint16_t n = slot.subevent * NUM_RSP_SLOTS + slot.rsp_slot;
+
+    if (atomic_test_and_set_bit(free_slots, n))
+        return; // already free
+
+    atomic_set_bit(summary, n / ATOMIC_BITS);
+    atomic_dec(&subevent_used[slot.subevent]);
+    atomic_dec(&total_used);
+}
+
+uint8_t slot_allocator_subevent_used(uint8_t subevent) {
+    return atomic_get(&subevent_used[subevent]);
+}
+
+uint16_t slot_allocator_total_used(void) {
+    return atomic_get(&total_used);
+}
+
+bool slot_allocator_should_compact(uint8_t subevent) {
+    if (!IS_ENABLED(CONFIG_ADV_SLOT_COMPACTION))
+        return false;
+    return subevent >= DIV_ROUND_UP(atomic_get(&total_used), NUM_RSP_SLOTS);
+}
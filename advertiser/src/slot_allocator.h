@@ -0,0 +1,48 @@
+#ifndef SLOT_ALLOCATOR_H
+#define SLOT_ALLOCATOR_H
+
+#include <app/lib/transfer.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_NUM_SUBEVENTS 46
+#define SLOT_COUNT (MAX_NUM_SUBEVENTS * NUM_RSP_SLOTS)
+
+/**
+ * \brief Marks every (subevent, rsp_slot) pair as free.
+ * Not safe against concurrent alloc/free, call before the advertiser starts.
+ */
+void slot_allocator_init(void);
+/**
+ * \brief Reserves the lowest free slot, going from subevent[0] rsp_slot[0]
+ * upwards. Handing out the lowest slot first keeps devices packed into as few
+ * subevents as possible. Lock-free, never blocks the caller.
+ *
+ * \return 0 on success, -1 if all SLOT_COUNT slots are taken
+ */
+int8_t slot_allocator_alloc(register_data_t *slot);
+/**
+ * \brief Returns slot to the allocator. Freeing a free slot does nothing.
+ * Lock-free, safe to call from any thread.
+ */
+void slot_allocator_free(register_data_t slot);
+/**
+ * \return Number of reserved slots in subevent
+ */
+uint8_t slot_allocator_subevent_used(uint8_t subevent);
+/**
+ * \return Number of reserved slots
+ */
+uint16_t slot_allocator_total_used(void);
+/**
+ * \brief Compaction policy.
+ * A device in subevent could be moved lower when its subevent isn't needed
+ * to hold all reserved slots, since the allocator then has a free slot in a
+ * lower subevent.
+ *
+ * \return true if CONFIG_ADV_SLOT_COMPACTION is enabled and a device in
+ * subevent should be moved
+ */
+bool slot_allocator_should_compact(uint8_t subevent);
+
+#endif // SLOT_ALLOCATOR_H
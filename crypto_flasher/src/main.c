@@ -50,7 +50,7 @@ int main() {
     printk("Flashed key 0\n");
 
     for (size_t i = 1; i < ARRAY_SIZE(keys); i++) {
-        net_buf_simple_init_with_data(&key_buf, keys[i], MAC_LEN);
+        net_buf_simple_init_with_data(&key_buf, keys[i], KEY_LEN);
         err = recreate_key(MIN_SCANNER_KEY_ID + i - 1, key_buf);
 
         if (err != PSA_SUCCESS)
@@ -58,13 +58,13 @@ int main() {
         printk("Flashed key %d\n", i);
     }
 #else  // advertiser part
-    net_buf_simple_init_with_data(&key_buf, keys[0], MAC_LEN);
+    net_buf_simple_init_with_data(&key_buf, keys[0], KEY_LEN);
     err = recreate_key(ADVERTISER_KEY_ID, key_buf);
     if (err != PSA_SUCCESS)
         goto ret_fail;
 
     net_buf_simple_init_with_data(
-        &key_buf, keys[CONFIG_FLASHED_DEVICE], MAC_LEN);
+        &key_buf, keys[CONFIG_FLASHED_DEVICE], KEY_LEN);
     err = recreate_key(MIN_SCANNER_KEY_ID, key_buf);
     if (err != PSA_SUCCESS)
         goto ret_fail;
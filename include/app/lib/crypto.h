@@ -2,18 +2,65 @@
 #define APP_LIB_CRYPTO_H
 
 #include <psa/crypto.h>
+#include <psa/internal_trusted_storage.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <zephyr/net_buf.h>
 #include <zephyr/psa/key_ids.h>
 
 #define HMAC_SHA_256 PSA_ALG_HMAC(PSA_ALG_SHA_256)
-#define HASH_LEN PSA_HASH_LENGTH(HMAC_SHA_256)
+
+/*
+ * Authenticator selected with CONFIG_CRYPTO_AUTHENTICATOR. MAC_LEN is the tag
+ * appended to every message and all message sizes follow from it.
+ */
+#if defined(CONFIG_CRYPTO_AUTH_HMAC_SHA256_16)
+#define CRYPTO_ALG PSA_ALG_TRUNCATED_MAC(HMAC_SHA_256, 16)
+#elif defined(CONFIG_CRYPTO_AUTH_HMAC_SHA256_8)
+#define CRYPTO_ALG PSA_ALG_TRUNCATED_MAC(HMAC_SHA_256, 8)
+#elif defined(CONFIG_CRYPTO_AUTH_AES_CMAC)
+#define CRYPTO_ALG PSA_ALG_CMAC
+#elif defined(CONFIG_CRYPTO_AUTH_AES_CCM)
+#define CRYPTO_ALG PSA_ALG_CCM
+#define CRYPTO_AEAD 1
+#else
+#define CRYPTO_ALG HMAC_SHA_256
+#endif
+
+#if defined(CONFIG_CRYPTO_AUTH_AES_CMAC) || defined(CONFIG_CRYPTO_AUTH_AES_CCM)
+#define CRYPTO_KEY_TYPE PSA_KEY_TYPE_AES
+#define KEY_BITS 128
+#else
+#define CRYPTO_KEY_TYPE PSA_KEY_TYPE_HMAC
 #define KEY_BITS 256
+#endif
 #define KEY_LEN (KEY_BITS / 8)
-#define KEY_FLAGS PSA_KEY_USAGE_SIGN_MESSAGE
-#define MAC_LEN PSA_MAC_LENGTH(PSA_KEY_TYPE_HMAC, KEY_BITS, HMAC_SHA_256)
-#define HASH_LEN PSA_HASH_LENGTH(HMAC_SHA_256)
+
+#if defined(CONFIG_CRYPTO_VOLATILE_KEY_CACHE)
+// Persistent keys are copied into volatile ones on first use
+#define KEY_COPY_FLAGS PSA_KEY_USAGE_COPY
+#else
+#define KEY_COPY_FLAGS 0
+#endif
+
+#if defined(CRYPTO_AEAD)
+#define KEY_FLAGS                                                              \
+    (PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT | KEY_COPY_FLAGS)
+#define MAC_LEN PSA_AEAD_TAG_LENGTH(CRYPTO_KEY_TYPE, KEY_BITS, CRYPTO_ALG)
+/** CCM nonce, the message counter followed by zeros */
+#define CRYPTO_NONCE_LEN 13
+#else
+#if defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+// Midstates are derived from the raw key, so every key becomes exportable
+#define KEY_FLAGS                                                              \
+    (PSA_KEY_USAGE_SIGN_MESSAGE | PSA_KEY_USAGE_EXPORT | KEY_COPY_FLAGS)
+#else
+#define KEY_FLAGS (PSA_KEY_USAGE_SIGN_MESSAGE | KEY_COPY_FLAGS)
+#endif
+#define MAC_LEN PSA_MAC_LENGTH(CRYPTO_KEY_TYPE, KEY_BITS, CRYPTO_ALG)
+#endif // CRYPTO_AEAD
+#define HASH_LEN MAC_LEN
 #define COUNTER_DATA_FLAGS PSA_STORAGE_FLAG_NO_CONFIDENTIALITY
 
 #define CRYPTO_KEY_DEFINE_STATIC(name)                                         \
@@ -35,8 +82,22 @@ psa_status_t crypto_init();
  */
 psa_status_t crypto_save_persistent_key(psa_key_id_t persistent_id,
                                struct net_buf_simple *key);
+#if defined(CONFIG_CRYPTO_SIM_KEYS)
+/**
+ * \brief Derives the simulation key of device_id and uses it for
+ * persistent_id.
+ * The key is SHA-256 of a fixed label and the device id, so all simulated
+ * devices agree on it. It's imported as a volatile key and looked up instead
+ * of persistent_id until the next reboot.
+ */
+psa_status_t crypto_sim_key_import(psa_key_id_t persistent_id,
+                                   uint16_t device_id);
+#endif // CONFIG_CRYPTO_SIM_KEYS
 /**
- * \brief Compute HMAC value and store it in mac_out
+ * \brief Compute CRYPTO_ALG MAC value and store it in mac_out
+ * With CONFIG_CRYPTO_HMAC_MIDSTATE the HMAC is computed from cached key
+ * midstates, keys that can't be exported fall back to psa_mac_compute.
+ * Not available with an AEAD authenticator.
  * \param key_id Id of the key to use
  * \param input input to hash
  * \param mac_out Output net buf
@@ -46,12 +107,125 @@ psa_status_t crypto_save_persistent_key(psa_key_id_t persistent_id,
 psa_status_t crypto_compute_mac(psa_key_id_t key_id, struct net_buf_simple *input,
                        size_t hashable_len, struct net_buf_simple *mac_out);
 
+/**
+ * \brief One input of crypto_compute_mac_batch and crypto_verify_mac_batch.
+ */
+typedef struct {
+    const uint8_t *input;
+    size_t input_len;
+    /**
+     * MAC_LEN bytes, output of crypto_compute_mac_batch and the expected tag
+     * for crypto_verify_mac_batch
+     */
+    uint8_t *mac;
+} crypto_mac_job_t;
+
+/**
+ * \brief Computes the MACs of several inputs with the same key.
+ * The key is looked up once for the whole batch, which saves the volatile key
+ * cache lookup and the midstate lookup per MAC. PSA has no multi-buffer MAC,
+ * so with TF-M, and with CONFIG_CRYPTO_SECURE_CALL_STUB, every job is still
+ * one secure call.
+ *
+ * \return 0 on success, otherwise error of the first failed job
+ */
+psa_status_t crypto_compute_mac_batch(psa_key_id_t key_id,
+                                      const crypto_mac_job_t *jobs,
+                                      size_t count);
+
+/** Jobs crypto_verify_mac_batch computes at once on its stack */
+#define CRYPTO_VERIFY_CHUNK 8
+
+/**
+ * \brief Checks the tags of several inputs against the same key.
+ * Computes the MACs with crypto_compute_mac_batch and compares each in
+ * constant time.
+ *
+ * \param valid Output, whether the tag of each job matched
+ *
+ * \return 0 if every tag matched, PSA_ERROR_INVALID_SIGNATURE if any didn't,
+ * otherwise error of computing the MACs, contents of valid are unspecified
+ * then
+ */
+psa_status_t crypto_verify_mac_batch(psa_key_id_t key_id,
+                                     const crypto_mac_job_t *jobs,
+                                     size_t count, bool *valid);
+
+#if defined(CONFIG_CRYPTO_SECURE_CALL_STUB)
+/**
+ * \brief Number of secure calls modelled by the stub backend since boot.
+ */
+uint32_t crypto_secure_call_count(void);
+#endif
+
+/**
+ * \brief Encrypts data in place and writes MAC_LEN bytes of tag.
+ * Only available with an AEAD authenticator.
+ *
+ * \param counter Message counter used as nonce, must never repeat for the
+ * same key
+ * \param ad Data which is authenticated but stays readable
+ * \param tag Output of MAC_LEN bytes
+ */
+psa_status_t crypto_aead_seal(psa_key_id_t key_id, uint64_t counter,
+                              const uint8_t *ad, size_t ad_len, uint8_t *data,
+                              size_t data_len, uint8_t *tag);
+/**
+ * \brief Checks tag and decrypts data in place.
+ *
+ * \return PSA_ERROR_INVALID_SIGNATURE if the tag doesn't match, contents of
+ * data are unspecified then
+ */
+psa_status_t crypto_aead_open(psa_key_id_t key_id, uint64_t counter,
+                              const uint8_t *ad, size_t ad_len, uint8_t *data,
+                              size_t data_len, const uint8_t *tag);
+
+/**
+ * \brief Monotonic counter persisted in PSA ITS.
+ * Only an upper bound is persisted, every CONFIG_CRYPTO_COUNTER_LEASE
+ * increments, so flash is written once per lease instead of once per message.
+ * After a reset the counter resumes from the last persisted bound, which is
+ * never below a value that was handed out.
+ *
+ * The bound is journaled in two ITS entries, storage_uid and storage_uid + 1,
+ * which are written in turns so that the newest complete record survives a
+ * reset during a write.
+ */
 typedef struct {
     uint64_t value;
-    psa_key_id_t storage_uid;
+    /** Persisted upper bound, value has to stay below it. */
+    uint64_t reserved;
+    /** Sequence number of the newest journal record. */
+    uint32_t seq;
+    psa_storage_uid_t storage_uid;
 } crypto_counter_t;
 
+/**
+ * \brief Resumes the counter from its journal and reserves a new lease.
+ * Counters stored by older firmware as a persistent RAW_DATA key are moved to
+ * the journal. If neither exists the counter starts at a random value.
+ *
+ * \return PSA_SUCCESS or error of the journal write
+ */
 psa_status_t crypto_secure_counter_init(crypto_counter_t *ctx);
+/**
+ * \brief Persists value + CONFIG_CRYPTO_COUNTER_LEASE as the new upper bound.
+ * Writes to flash, don't call from timing critical contexts.
+ */
 psa_status_t crypto_secure_counter_commit(crypto_counter_t *ctx);
+/**
+ * \brief Increments the counter without touching flash.
+ *
+ * \return true when less than half a lease is left and
+ * crypto_secure_counter_commit should be called
+ */
+bool crypto_secure_counter_advance(crypto_counter_t *ctx);
+/**
+ * \brief Checks the lease after value was raised, e.g. by verify_message.
+ *
+ * \return true when less than half a lease is left and
+ * crypto_secure_counter_commit should be called
+ */
+bool crypto_secure_counter_sync(const crypto_counter_t *ctx);
 
 #endif // APP_LIB_CRYPTO_H
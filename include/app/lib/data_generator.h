@@ -13,18 +13,21 @@
  * After each \ref
  * interval ms a net_buf_simple with \ref len data is generated.  The caller is
  * notified about the generator via \ref generated function.
+ * Every config runs its own generator, so it has to outlive it.
  */
-typedef struct {
+typedef struct data_generator_config {
     struct net_buf_simple *data;
     int interval;
     void (*init_buf)();
-    void (*generated)();
+    void (*generated)(struct data_generator_config *config);
+    /** Private, fires every interval */
+    struct k_timer timer;
 } data_generator_config_t;
 
 /**
  * Initializes data generator
  */
 void data_generator_init(data_generator_config_t *config); 
-void data_generator_stop();
+void data_generator_stop(data_generator_config_t *config);
 
 #endif // APP_LIB_DATA_GENERATOR_H
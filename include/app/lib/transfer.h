@@ -7,7 +7,76 @@
 
 #define PACKED __attribute__((__packed__))
 
-#define UNUSED_DATA_LEN 62 - HASH_LEN - sizeof(uint64_t) - sizeof(rsp_data_t) - sizeof(uint8_t)
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+/**
+ * Counter bytes subevents and responses carry on air, the receiver fills in
+ * the rest from its replay window. Advertisements carry the whole counter.
+ */
+#define COUNTER_WIRE_LEN (CONFIG_TRANSFER_COUNTER_WIRE_BITS / BITS_PER_BYTE)
+/** Set in the flags byte leading a response when the sender id follows */
+#define RESPONSE_FLAG_SENDER_ID BIT(0)
+/**
+ * Longest readable header of a response, a flags byte and the sender id,
+ * which picks the key the response is verified with.
+ */
+#define RESPONSE_HEADER_LEN (sizeof(uint8_t) + sizeof(uint16_t))
+/**
+ * Header of a response from the owner of its slot, only the flags byte. Data
+ * is only sent from an owned slot.
+ */
+#define RESPONSE_SLOT_HEADER_LEN sizeof(uint8_t)
+#else
+#define COUNTER_WIRE_LEN sizeof(uint64_t)
+/**
+ * Leading bytes of a response which stay readable, the sender id which picks
+ * the key the response is verified with.
+ */
+#define RESPONSE_HEADER_LEN sizeof(uint16_t)
+#define RESPONSE_SLOT_HEADER_LEN RESPONSE_HEADER_LEN
+#endif // CONFIG_TRANSFER_COMPACT_FRAMING
+
+/**
+ * Room a message needs on top of its length on air until signing drops the
+ * high counter bytes.
+ */
+#define COUNTER_WIRE_SLACK (sizeof(uint64_t) - COUNTER_WIRE_LEN)
+
+/**
+ * Payload which fills a data response, sent from the sender's own slot, to 62
+ * bytes.
+ */
+#define UNUSED_DATA_LEN                                                        \
+    (62 - HASH_LEN - COUNTER_WIRE_LEN - RESPONSE_SLOT_HEADER_LEN -             \
+     sizeof(uint8_t))
+
+#define NUM_RSP_SLOTS 103
+#define SUBEVENT_DATA_MAX_LEN 251
+
+/**
+ * One bit per response slot, bit n of byte n / 8 is set when rsp_slot n got
+ * acked.
+ */
+#define ACK_BITMAP_LEN DIV_ROUND_UP(NUM_RSP_SLOTS, BITS_PER_BYTE)
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+/** Subevents signed together, subevent s is leaf s % BATCH_SIZE */
+#define BATCH_SIZE BIT(CONFIG_TRANSFER_BATCH_DEPTH)
+/** Nodes of the batch hash tree are SHA-256 truncated to this length */
+#define BATCH_NODE_LEN 16
+/** Sibling nodes from a leaf up to the root, carried by every subevent */
+#define BATCH_PROOF_LEN (CONFIG_TRANSFER_BATCH_DEPTH * BATCH_NODE_LEN)
+#else
+#define BATCH_PROOF_LEN 0
+#endif
+
+/**
+ * Number of ack ids which still fit in a signed subevent next to the bitmap
+ * and the counter. With a short tag every slot fits.
+ */
+#define ACK_MAX_IDS                                                            \
+    MIN((SUBEVENT_DATA_MAX_LEN - ACK_BITMAP_LEN - COUNTER_WIRE_LEN -           \
+         BATCH_PROOF_LEN - HASH_LEN) /                                         \
+            sizeof(uint16_t),                                                  \
+        NUM_RSP_SLOTS)
 
 #define SERIALIZER_DECLARE(name, type)                                         \
     void name(type *data, struct net_buf_simple *result);
@@ -29,7 +98,6 @@ typedef struct PACKED {
 
 typedef struct PACKED {
     uint16_t sender_id;
-    uint32_t counter;
 } rsp_data_t;
 
 typedef enum PACKED { REGISTER_DATA, ACK_DATA } data_t;
@@ -39,9 +107,40 @@ typedef struct PACKED {
     uint8_t rsp_slot;
 } register_data_t;
 
-typedef struct PACKED {
-    uint16_t ack_id;
-} ack_data_t;
+/**
+ * \brief Compact set of acks sent in a subevent.
+ * Only acked slots are stored: \ref bitmap marks which rsp_slots got acked and
+ * \ref ids holds the ids of the acked devices in ascending slot order. On air
+ * this takes ACK_BITMAP_LEN bytes plus 2 bytes per ack instead of 2 bytes for
+ * every one of NUM_RSP_SLOTS slots.
+ */
+typedef struct {
+    uint8_t bitmap[ACK_BITMAP_LEN];
+    uint16_t ids[ACK_MAX_IDS];
+    uint8_t count;
+} ack_set_t;
+
+/**
+ * \brief Read-only view of a verified subevent.
+ * Points into the received buffer instead of copying out of it, so it stays
+ * valid only as long as the buffer does. Fields are wire bytes, read them
+ * through the subevent_view_ functions.
+ */
+typedef struct {
+    const uint8_t *register_data;
+    const uint8_t *ids;
+    const uint8_t *bitmap;
+    uint8_t register_data_count;
+    uint8_t ack_count;
+} subevent_view_t;
+
+/**
+ * \brief Position of subevent_view_next_ack, starts zeroed.
+ */
+typedef struct {
+    uint8_t rsp_slot;
+    uint8_t index;
+} subevent_view_iter_t;
 
 typedef struct {
     register_data_t *reg_data;
@@ -51,10 +150,9 @@ typedef struct {
 
 typedef struct {
     register_data_t *register_data;
-    ack_data_t *ack_data;
+    ack_set_t *acks;
     uint64_t counter;
     size_t _register_data_count;
-    size_t _ack_data_count;
 } subevent_data_t;
 
 typedef struct {
@@ -62,6 +160,11 @@ typedef struct {
     uint8_t *data;
     uint8_t data_len;
     uint64_t counter;
+    /**
+     * Sender owns the response slot, so with compact framing the sender id is
+     * left out.
+     */
+    bool sender_in_slot;
 } response_data_t;
 
 typedef enum {
@@ -69,13 +172,186 @@ typedef enum {
     TRANSFER_COULDNT_COMPUTE_MAC,
     TRANSFER_MESSAGE_TO_SHORT,
     TRANSFER_INVALID_HASH,
-    TRANSFER_COUNTER_DIDNT_MATCH
+    TRANSFER_COUNTER_DIDNT_MATCH,
+    TRANSFER_TOO_MANY_ACKS
 } transfer_error_t;
 
+/** Counters behind the newest one that can still be accepted */
+#define REPLAY_WINDOW_LEN 64
+
+/**
+ * \brief Counters accepted from one sender.
+ * Bit i of seen is set once newest - i was accepted. Counters above newest
+ * are always fresh, the ones inside the window are accepted once, in any
+ * order.
+ */
+typedef struct {
+    uint64_t newest;
+    uint64_t seen;
+} replay_window_t;
+
+/**
+ * \brief Starts the window at newest, with every older counter used up.
+ */
+void replay_window_init(replay_window_t *window, uint64_t newest);
+/**
+ * \brief Starts the window again at floor if its newest counter is older.
+ */
+void replay_window_raise(replay_window_t *window, uint64_t floor);
+/**
+ * \brief Expands the low counter bits sent with compact framing to the
+ * counter closest to reference.
+ * Senders may be at most half the range of the sent bits away from the
+ * receiver's reference.
+ */
+uint64_t counter_from_wire(uint64_t wire, uint64_t reference);
+/**
+ * \return TRANSFER_COUNTER_DIDNT_MATCH if counter was already accepted or is
+ * older than the window
+ */
+transfer_error_t replay_window_check(const replay_window_t *window,
+                                     uint64_t counter);
+/**
+ * \brief Marks counter as accepted, sliding the window if it's newer.
+ * Counter has to have passed replay_window_check.
+ */
+void replay_window_accept(replay_window_t *window, uint64_t counter);
+
 transfer_error_t sign_message(struct net_buf_simple *serialized,
                               psa_key_id_t key_id);
+/**
+ * \brief Verifies a message and accepts its counter into window.
+ * The window is only updated if the message verified.
+ */
 transfer_error_t verify_message(struct net_buf_simple *message,
-                                psa_key_id_t key_id, uint64_t *counter);
+                                psa_key_id_t key_id, replay_window_t *window);
+/**
+ * \brief Signs a message whose first header_len bytes have to stay readable.
+ * With an AEAD authenticator everything between the header and the counter
+ * is encrypted, the header and the counter are only authenticated. With
+ * compact framing only COUNTER_WIRE_LEN bytes of the counter are kept, the
+ * whole counter is still authenticated.
+ */
+transfer_error_t sign_message_with_header(struct net_buf_simple *serialized,
+                                          size_t header_len,
+                                          psa_key_id_t key_id);
+/**
+ * \brief Counterpart of sign_message_with_header, leaves the header and the
+ * decrypted payload in message. A truncated counter is expanded around
+ * the newest counter of window.
+ */
+transfer_error_t verify_message_with_header(struct net_buf_simple *message,
+                                            size_t header_len,
+                                            psa_key_id_t key_id,
+                                            replay_window_t *window);
+
+/**
+ * \brief Reads the counter of a message signed with sign_message_with_header
+ * without verifying it, a truncated one expanded around reference.
+ * Lets a receiver drop stale messages before computing the MAC, the counter
+ * still has to be verified afterwards.
+ *
+ * \return TRANSFER_MESSAGE_TO_SHORT if the message can't hold a counter and
+ * a tag
+ */
+transfer_error_t peek_message_counter(const struct net_buf_simple *message,
+                                      size_t header_len, uint64_t reference,
+                                      uint64_t *counter);
+/**
+ * \brief Length of the readable header of a serialized response.
+ */
+size_t response_header_len(const struct net_buf_simple *response);
+/**
+ * \brief Reads the sender id from the header of a serialized response.
+ *
+ * \return false if the response was sent without one, the response slot
+ * identifies the sender then
+ */
+bool response_sender_id(const struct net_buf_simple *response,
+                        uint16_t *sender_id);
+/**
+ * \brief Signs count subevents with the same key, like calling
+ * sign_message_with_header without a header on each of them, but with the
+ * MACs computed in batches.
+ */
+transfer_error_t sign_messages(struct net_buf_simple *messages[], size_t count,
+                               psa_key_id_t key_id);
+/**
+ * \brief Verifies a subevent message, as part of a batch with
+ * CONFIG_TRANSFER_BATCH_SIGNING and on its own otherwise.
+ */
+transfer_error_t verify_subevent_message(struct net_buf_simple *message,
+                                         uint8_t subevent, psa_key_id_t key_id,
+                                         replay_window_t *window);
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+/**
+ * \brief Signs up to BATCH_SIZE messages with one MAC.
+ * The messages are the leaves of a hash tree whose root is MACed. Every
+ * message gets its BATCH_PROOF_LEN bytes of sibling nodes and the MAC
+ * appended, so it can be verified without the rest of the batch. Each leaf
+ * binds the subevent number along with the message and its counter, so a
+ * message only verifies in the subevent and event it was signed for.
+ *
+ * \param messages Leaves of the tree, NULL for messages which aren't sent
+ * \param first_subevent Subevent of messages[0], a multiple of BATCH_SIZE
+ */
+transfer_error_t sign_message_batch(struct net_buf_simple *messages[BATCH_SIZE],
+                                    uint8_t first_subevent,
+                                    psa_key_id_t key_id);
+/**
+ * \brief Verifies a message signed by sign_message_batch for subevent.
+ */
+transfer_error_t verify_message_batch(struct net_buf_simple *message,
+                                      uint8_t subevent, psa_key_id_t key_id,
+                                      replay_window_t *window);
+#endif // CONFIG_TRANSFER_BATCH_SIGNING
+
+/**
+ * \brief Clears all acks from the set.
+ */
+void ack_set_init(ack_set_t *acks);
+/**
+ * \brief Acks rsp_slot with ack_id.
+ * Slots need to be added in ascending order.
+ *
+ * \return TRANSFER_TOO_MANY_ACKS if ACK_MAX_IDS acks were already added
+ */
+transfer_error_t ack_set_add(ack_set_t *acks, uint8_t rsp_slot,
+                             uint16_t ack_id);
+/**
+ * \brief Returns id acked in rsp_slot or 0 if the slot wasn't acked.
+ */
+uint16_t ack_set_get(const ack_set_t *acks, uint8_t rsp_slot);
+
+/**
+ * \brief Checks a verified subevent and points view at its fields.
+ * Same layout as subevent_data_with_reg_deserialize expects, but data is left
+ * untouched and nothing gets decoded until asked for.
+ *
+ * \param register_data_count Register slots in front of the acks, 0 to skip
+ * them
+ */
+transfer_error_t subevent_view_init(subevent_view_t *view,
+                                    const struct net_buf_simple *data,
+                                    uint8_t register_data_count);
+/**
+ * \brief Returns id acked in rsp_slot or 0 if the slot wasn't acked.
+ */
+uint16_t subevent_view_ack(const subevent_view_t *view, uint8_t rsp_slot);
+/**
+ * \brief Returns register slot index of the view, index has to be below
+ * register_data_count.
+ */
+register_data_t subevent_view_register_data(const subevent_view_t *view,
+                                            uint8_t index);
+/**
+ * \brief Steps iter to the next acked slot in ascending slot order.
+ *
+ * \return false once all acks were visited
+ */
+bool subevent_view_next_ack(const subevent_view_t *view,
+                            subevent_view_iter_t *iter, uint8_t *rsp_slot,
+                            uint16_t *ack_id);
 
 SERIALIZER_DECLARE(advertisement_data_serialize, advertisement_data_t);
 SERIALIZER_DECLARE(subevent_data_with_reg_serialize, subevent_data_t);
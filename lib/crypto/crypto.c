@@ -1,6 +1,93 @@
 #include <app/lib/crypto.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
 
-#define BIT_SIZEOF(type) sizeof(type) * BITS_PER_BYTE
+#if defined(CONFIG_CRYPTO_SECURE_CALL_STUB)
+#include "secure_call_stub.h"
+#endif
+
+#if defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+#define SHA_256_BLOCK_LEN PSA_HASH_BLOCK_LENGTH(PSA_ALG_SHA_256)
+#define HMAC_IPAD 0x36
+#define HMAC_OPAD 0x5c
+
+/**
+ * \brief SHA-256 state after absorbing key ^ ipad and key ^ opad.
+ * HMAC(k, m) = H(k ^ opad || H(k ^ ipad || m)), so with both states kept
+ * computing a MAC only hashes the message and the inner digest.
+ */
+typedef struct {
+    psa_key_id_t key_id;
+    psa_status_t status;
+    psa_hash_operation_t inner;
+    psa_hash_operation_t outer;
+} hmac_midstate_t;
+
+/**
+ * Direct mapped by key id. status holds why a key can't be cached, so keys
+ * which aren't exportable are only tried once.
+ */
+static hmac_midstate_t midstates[CONFIG_CRYPTO_HMAC_MIDSTATE_CACHE_SIZE];
+K_MUTEX_DEFINE(midstate_mutex);
+
+static psa_status_t midstate_load(hmac_midstate_t *m, psa_key_id_t key_id);
+static void midstate_forget(psa_key_id_t key_id);
+static psa_status_t midstate_compute(psa_key_id_t key_id, const uint8_t *input,
+                                     size_t input_len, uint8_t *mac);
+#endif // CONFIG_CRYPTO_HMAC_MIDSTATE
+
+#if defined(CONFIG_CRYPTO_VOLATILE_KEY_CACHE)
+/**
+ * \brief Volatile copy of a persistent key.
+ * Volatile keys are used as they are, copy_id is key_id then. status holds
+ * why a key couldn't be copied, so keys without PSA_KEY_USAGE_COPY are only
+ * tried once.
+ */
+typedef struct {
+    psa_key_id_t key_id;
+    psa_key_id_t copy_id;
+    psa_status_t status;
+} key_copy_t;
+
+/**
+ * Direct mapped by key id. Held from key_acquire to key_release, since a miss
+ * on another key destroys the copy in its entry.
+ */
+static key_copy_t key_copies[CONFIG_CRYPTO_VOLATILE_KEY_CACHE_SIZE];
+K_MUTEX_DEFINE(key_copy_mutex);
+
+static psa_key_id_t key_acquire(psa_key_id_t key_id);
+static inline void key_release(void) { k_mutex_unlock(&key_copy_mutex); }
+#elif defined(CONFIG_CRYPTO_SIM_KEYS)
+#define SIM_KEY_LABEL "pawr-sim-key"
+
+/**
+ * Volatile key standing in for persistent id PSA_KEY_ID_USER_MIN + n, 0 when
+ * none was imported.
+ */
+static psa_key_id_t sim_keys[CONFIG_CRYPTO_SIM_KEYS_MAX];
+
+static inline psa_key_id_t *sim_key_entry(psa_key_id_t key_id) {
+    if (key_id < PSA_KEY_ID_USER_MIN ||
+        key_id - PSA_KEY_ID_USER_MIN >= ARRAY_SIZE(sim_keys))
+        return NULL;
+    return &sim_keys[key_id - PSA_KEY_ID_USER_MIN];
+}
+
+static inline psa_key_id_t key_acquire(psa_key_id_t key_id) {
+    psa_key_id_t *entry = sim_key_entry(key_id);
+
+    return entry && *entry != 0 ? *entry : key_id;
+}
+static inline void key_release(void) {}
+#else
+static inline psa_key_id_t key_acquire(psa_key_id_t key_id) { return key_id; }
+static inline void key_release(void) {}
+#endif // CONFIG_CRYPTO_VOLATILE_KEY_CACHE
+
+static psa_status_t mac_backend(psa_key_id_t key_id,
+                                const crypto_mac_job_t *jobs, size_t count);
 
 inline psa_status_t crypto_init() { return psa_crypto_init(); }
 
@@ -11,55 +98,443 @@ psa_status_t crypto_save_persistent_key(psa_key_id_t persistent_id,
 
     psa_set_key_id(&attributes, persistent_id);
     psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_PERSISTENT);
-    psa_set_key_type(&attributes, PSA_KEY_TYPE_HMAC);
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
     psa_set_key_bits(&attributes, KEY_BITS);
     psa_set_key_usage_flags(&attributes, KEY_FLAGS);
-    psa_set_key_algorithm(&attributes, HMAC_SHA_256);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
 
     return psa_import_key(&attributes, key->data, key->len, &ret_id);
 }
 
-int crypto_compute_mac(psa_key_id_t key_id, struct net_buf_simple *input,
-                       size_t hashable_len, struct net_buf_simple *mac_out) {
+#if defined(CONFIG_CRYPTO_SIM_KEYS)
+psa_status_t crypto_sim_key_import(psa_key_id_t persistent_id,
+                                   uint16_t device_id) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t *entry = sim_key_entry(persistent_id);
+    uint8_t input[sizeof(SIM_KEY_LABEL) + sizeof(uint16_t)];
+    uint8_t key[PSA_HASH_LENGTH(PSA_ALG_SHA_256)];
+    size_t key_len;
+    psa_status_t err;
+
+    BUILD_ASSERT(KEY_LEN <= sizeof(key), "Keys are cut from one digest");
+    if (!entry)
+        return PSA_ERROR_INVALID_ARGUMENT;
+
+    memcpy(input, SIM_KEY_LABEL, sizeof(SIM_KEY_LABEL));
+    sys_put_le16(device_id, input + sizeof(SIM_KEY_LABEL));
+    err = psa_hash_compute(PSA_ALG_SHA_256, input, sizeof(input), key,
+                           sizeof(key), &key_len);
+    if (err != PSA_SUCCESS)
+        return err;
+
+    if (*entry != 0) {
+        psa_destroy_key(*entry);
+        *entry = 0;
+    }
+    psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_VOLATILE);
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+
+#if defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+    // The midstate of the key this one replaces is still cached
+    midstate_forget(persistent_id);
+#endif
+    return psa_import_key(&attributes, key, KEY_LEN, entry);
+}
+#endif // CONFIG_CRYPTO_SIM_KEYS
+
+psa_status_t crypto_compute_mac(psa_key_id_t key_id,
+                                struct net_buf_simple *input,
+                                size_t hashable_len,
+                                struct net_buf_simple *mac_out) {
+    crypto_mac_job_t job = {
+        .input = input->data,
+        .input_len = hashable_len,
+        .mac = net_buf_simple_add(mac_out, MAC_LEN),
+    };
+
+    return crypto_compute_mac_batch(key_id, &job, 1);
+}
+
+psa_status_t crypto_compute_mac_batch(psa_key_id_t key_id,
+                                      const crypto_mac_job_t *jobs,
+                                      size_t count) {
+    psa_status_t err;
+    size_t done = 0;
+
+#if defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+    for (; done < count; done++) {
+        if (midstate_compute(key_id, jobs[done].input, jobs[done].input_len,
+                             jobs[done].mac) != PSA_SUCCESS)
+            break;
+    }
+    if (done == count)
+        return PSA_SUCCESS;
+#endif // CONFIG_CRYPTO_HMAC_MIDSTATE
+
+    err = mac_backend(key_acquire(key_id), jobs + done, count - done);
+    key_release();
+    return err;
+}
+
+/**
+ * \brief Computes count MACs with the crypto backend.
+ * PSA has no multi-buffer MAC, so with TF-M every job crosses into the secure
+ * side on its own. The native_sim stub charges each job the same way.
+ */
+static psa_status_t mac_backend(psa_key_id_t key_id,
+                                const crypto_mac_job_t *jobs, size_t count) {
+    psa_status_t err = PSA_SUCCESS;
     size_t out_len;
-    uint8_t *mac_data = net_buf_simple_add(mac_out, MAC_LEN);
 
-    return psa_mac_compute(key_id, HMAC_SHA_256, input->data, hashable_len,
-                           mac_data, MAC_LEN, &out_len);
+    for (size_t i = 0; i < count && err == PSA_SUCCESS; i++) {
+#if defined(CONFIG_CRYPTO_SECURE_CALL_STUB)
+        secure_call_stub_enter(key_id);
+#endif
+        err = psa_mac_compute(key_id, CRYPTO_ALG, jobs[i].input,
+                              jobs[i].input_len, jobs[i].mac, MAC_LEN,
+                              &out_len);
+    }
+    return err;
 }
 
-psa_status_t crypto_secure_counter_init(crypto_counter_t *ctx) {
+psa_status_t crypto_verify_mac_batch(psa_key_id_t key_id,
+                                     const crypto_mac_job_t *jobs,
+                                     size_t count, bool *valid) {
+    uint8_t macs[CRYPTO_VERIFY_CHUNK][MAC_LEN];
+    crypto_mac_job_t chunk[CRYPTO_VERIFY_CHUNK];
+    psa_status_t err;
+    bool all_valid = true;
+
+    for (size_t first = 0; first < count; first += CRYPTO_VERIFY_CHUNK) {
+        size_t n = MIN(count - first, CRYPTO_VERIFY_CHUNK);
+
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = jobs[first + i];
+            chunk[i].mac = macs[i];
+        }
+        err = crypto_compute_mac_batch(key_id, chunk, n);
+        if (err != PSA_SUCCESS)
+            return err;
+
+        for (size_t i = 0; i < n; i++) {
+            uint8_t diff = 0;
+
+            // Compares the whole tag, so timing doesn't tell how much matched
+            for (size_t j = 0; j < MAC_LEN; j++)
+                diff |= macs[i][j] ^ jobs[first + i].mac[j];
+            valid[first + i] = diff == 0;
+            all_valid &= diff == 0;
+        }
+    }
+    return all_valid ? PSA_SUCCESS : PSA_ERROR_INVALID_SIGNATURE;
+}
+
+#if defined(CRYPTO_AEAD)
+static inline void aead_nonce(uint64_t counter, uint8_t *nonce) {
+    memset(nonce, 0, CRYPTO_NONCE_LEN);
+    sys_put_le64(counter, nonce);
+}
+
+psa_status_t crypto_aead_seal(psa_key_id_t key_id, uint64_t counter,
+                              const uint8_t *ad, size_t ad_len, uint8_t *data,
+                              size_t data_len, uint8_t *tag) {
+    // PSA returns ciphertext || tag in one buffer
+    uint8_t out[CONFIG_CRYPTO_AEAD_MAX_DATA_LEN + MAC_LEN];
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    size_t out_len;
     psa_status_t err;
+
+    if (data_len > CONFIG_CRYPTO_AEAD_MAX_DATA_LEN)
+        return PSA_ERROR_BUFFER_TOO_SMALL;
+
+    aead_nonce(counter, nonce);
+    err = psa_aead_encrypt(key_acquire(key_id), CRYPTO_ALG, nonce,
+                           sizeof(nonce), ad, ad_len, data, data_len, out,
+                           sizeof(out), &out_len);
+    key_release();
+    if (err != PSA_SUCCESS)
+        return err;
+    if (out_len != data_len + MAC_LEN)
+        return PSA_ERROR_GENERIC_ERROR;
+
+    memcpy(data, out, data_len);
+    memcpy(tag, out + data_len, MAC_LEN);
+    return PSA_SUCCESS;
+}
+
+psa_status_t crypto_aead_open(psa_key_id_t key_id, uint64_t counter,
+                              const uint8_t *ad, size_t ad_len, uint8_t *data,
+                              size_t data_len, const uint8_t *tag) {
+    uint8_t in[CONFIG_CRYPTO_AEAD_MAX_DATA_LEN + MAC_LEN];
+    uint8_t nonce[CRYPTO_NONCE_LEN];
+    size_t out_len;
+    psa_status_t err;
+
+    if (data_len > CONFIG_CRYPTO_AEAD_MAX_DATA_LEN)
+        return PSA_ERROR_BUFFER_TOO_SMALL;
+
+    memcpy(in, data, data_len);
+    memcpy(in + data_len, tag, MAC_LEN);
+    aead_nonce(counter, nonce);
+    err = psa_aead_decrypt(key_acquire(key_id), CRYPTO_ALG, nonce,
+                           sizeof(nonce), ad, ad_len, in, data_len + MAC_LEN,
+                           data, data_len, &out_len);
+    key_release();
+    return err;
+}
+#endif // CRYPTO_AEAD
+
+/**
+ * \brief One entry of the counter journal.
+ */
+typedef struct {
+    uint64_t reserved;
+    uint32_t seq;
+} counter_record_t;
+
+static inline psa_storage_uid_t journal_uid(const crypto_counter_t *ctx,
+                                            uint32_t seq) {
+    return ctx->storage_uid + seq % 2;
+}
+
+static psa_status_t journal_read(const crypto_counter_t *ctx,
+                                 counter_record_t *newest) {
+    counter_record_t record;
+    psa_status_t err, ret = PSA_ERROR_DOES_NOT_EXIST;
     size_t read;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        err = psa_its_get(journal_uid(ctx, i), 0, sizeof(record), &record,
+                          &read);
+        if (err == PSA_ERROR_DOES_NOT_EXIST)
+            continue;
+        if (err != PSA_SUCCESS)
+            return err;
+        if (read != sizeof(record) || record.seq % 2 != i)
+            continue;
+
+        if (ret != PSA_SUCCESS || record.seq > newest->seq)
+            *newest = record;
+        ret = PSA_SUCCESS;
+    }
+    return ret;
+}
+
+/**
+ * \brief Reads a counter stored as a persistent RAW_DATA key and removes it.
+ * Older firmware only kept the low 32 bits of the value in the key.
+ */
+static psa_status_t legacy_counter_take(crypto_counter_t *ctx) {
+    psa_status_t err;
     uint8_t tmp[sizeof(ctx->value)];
-    err = psa_export_key(ctx->storage_uid, tmp, sizeof(ctx->value), &read);
+    size_t read;
+
+    err = psa_export_key(ctx->storage_uid, tmp, sizeof(tmp), &read);
+    if (err != PSA_SUCCESS)
+        return err;
+
+    ctx->value = 0;
     memcpy(&ctx->value, tmp, read);
 
-    if (err == PSA_ERROR_INVALID_HANDLE) {
-        psa_generate_random(tmp, sizeof(ctx->value));
-        for (size_t i = 0; i < sizeof(ctx->value); i++) {
-            ctx->value |= tmp[i] << i * 8;
-        }
+    // Journal a bound first so the counter can't be lost in between
+    ctx->reserved = ctx->value;
+    err = crypto_secure_counter_commit(ctx);
+    if (err != PSA_SUCCESS)
+        return err;
+    return psa_destroy_key(ctx->storage_uid);
+}
+
+psa_status_t crypto_secure_counter_init(crypto_counter_t *ctx) {
+    counter_record_t record;
+    psa_status_t err;
+
+    ctx->seq = 0;
+    err = journal_read(ctx, &record);
+    if (err == PSA_SUCCESS) {
+        ctx->value = record.reserved;
+        ctx->reserved = record.reserved;
+        ctx->seq = record.seq;
         return crypto_secure_counter_commit(ctx);
     }
-    return err;
+    if (err != PSA_ERROR_DOES_NOT_EXIST)
+        return err;
+
+    err = legacy_counter_take(ctx);
+    if (err != PSA_ERROR_INVALID_HANDLE && err != PSA_ERROR_DOES_NOT_EXIST)
+        return err;
+
+    err = psa_generate_random((uint8_t *)&ctx->value, sizeof(ctx->value));
+    if (err != PSA_SUCCESS)
+        return err;
+    // Leave room below UINT64_MAX for any number of leases
+    ctx->value >>= 1;
+    ctx->reserved = ctx->value;
+    return crypto_secure_counter_commit(ctx);
 }
 
-inline psa_status_t crypto_secure_counter_commit(crypto_counter_t *ctx) {
-    psa_key_id_t ret_id;
-    psa_key_attributes_t attributes;
+psa_status_t crypto_secure_counter_commit(crypto_counter_t *ctx) {
+    counter_record_t record = {
+        .reserved = ctx->value + CONFIG_CRYPTO_COUNTER_LEASE,
+        .seq = ctx->seq + 1,
+    };
     psa_status_t err;
 
-    err = psa_destroy_key(ctx->storage_uid);
-    if (err != PSA_SUCCESS && err != PSA_ERROR_INVALID_HANDLE)
+    err = psa_its_set(journal_uid(ctx, record.seq), sizeof(record), &record,
+                      COUNTER_DATA_FLAGS);
+    if (err != PSA_SUCCESS)
         return err;
 
-    psa_set_key_id(&attributes, ctx->storage_uid);
-    psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_PERSISTENT);
-    psa_set_key_type(&attributes, PSA_KEY_TYPE_RAW_DATA);
-    psa_set_key_bits(&attributes, BIT_SIZEOF(ctx->storage_uid));
-    psa_set_key_usage_flags(&attributes, PSA_KEY_USAGE_EXPORT);
+    ctx->reserved = record.reserved;
+    ctx->seq = record.seq;
+    return PSA_SUCCESS;
+}
+
+bool crypto_secure_counter_advance(crypto_counter_t *ctx) {
+    ctx->value++;
+    return crypto_secure_counter_sync(ctx);
+}
+
+bool crypto_secure_counter_sync(const crypto_counter_t *ctx) {
+    return ctx->value + CONFIG_CRYPTO_COUNTER_LEASE / 2 >= ctx->reserved;
+}
+
+#if defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+static void secure_zero(void *buf, size_t len) {
+    volatile uint8_t *p = buf;
+
+    while (len--)
+        *p++ = 0;
+}
+
+static psa_status_t pad_state(psa_hash_operation_t *op, const uint8_t *key,
+                              size_t key_len, uint8_t pad) {
+    uint8_t block[SHA_256_BLOCK_LEN];
+    psa_status_t err;
+
+    memset(block, pad, sizeof(block));
+    for (size_t i = 0; i < key_len; i++)
+        block[i] ^= key[i];
+
+    *op = psa_hash_operation_init();
+    err = psa_hash_setup(op, PSA_ALG_SHA_256);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_update(op, block, sizeof(block));
+    if (err != PSA_SUCCESS)
+        psa_hash_abort(op);
+
+    secure_zero(block, sizeof(block));
+    return err;
+}
+
+static psa_status_t midstate_load(hmac_midstate_t *m, psa_key_id_t key_id) {
+    uint8_t key[KEY_LEN];
+    size_t key_len;
+    psa_status_t err;
+
+    if (m->key_id != 0 && m->status == PSA_SUCCESS) {
+        psa_hash_abort(&m->inner);
+        psa_hash_abort(&m->outer);
+    }
+    m->key_id = key_id;
+
+    // Keys longer than a block would need hashing first, ours never are
+    err = psa_export_key(key_acquire(key_id), key, sizeof(key), &key_len);
+    key_release();
+    if (err == PSA_SUCCESS)
+        err = pad_state(&m->inner, key, key_len, HMAC_IPAD);
+    if (err == PSA_SUCCESS) {
+        err = pad_state(&m->outer, key, key_len, HMAC_OPAD);
+        if (err != PSA_SUCCESS)
+            psa_hash_abort(&m->inner);
+    }
+
+    secure_zero(key, sizeof(key));
+    m->status = err;
+    return err;
+}
+
+static void midstate_forget(psa_key_id_t key_id) {
+    hmac_midstate_t *m = &midstates[key_id % ARRAY_SIZE(midstates)];
+
+    k_mutex_lock(&midstate_mutex, K_FOREVER);
+    if (m->key_id == key_id) {
+        if (m->status == PSA_SUCCESS) {
+            psa_hash_abort(&m->inner);
+            psa_hash_abort(&m->outer);
+        }
+        m->key_id = 0;
+    }
+    k_mutex_unlock(&midstate_mutex);
+}
+
+static psa_status_t midstate_compute(psa_key_id_t key_id, const uint8_t *input,
+                                     size_t input_len, uint8_t *mac) {
+    psa_hash_operation_t inner = PSA_HASH_OPERATION_INIT;
+    psa_hash_operation_t outer = PSA_HASH_OPERATION_INIT;
+    hmac_midstate_t *m = &midstates[key_id % ARRAY_SIZE(midstates)];
+    uint8_t digest[PSA_HASH_LENGTH(PSA_ALG_SHA_256)];
+    size_t len;
+    psa_status_t err;
+
+    k_mutex_lock(&midstate_mutex, K_FOREVER);
+    err = m->key_id == key_id ? m->status : midstate_load(m, key_id);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_clone(&m->inner, &inner);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_clone(&m->outer, &outer);
+    k_mutex_unlock(&midstate_mutex);
+    if (err != PSA_SUCCESS)
+        goto abort;
+
+    err = psa_hash_update(&inner, input, input_len);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_finish(&inner, digest, sizeof(digest), &len);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_update(&outer, digest, len);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_finish(&outer, digest, sizeof(digest), &len);
+    // Truncated MACs are the leading bytes of the full HMAC
+    if (err == PSA_SUCCESS)
+        memcpy(mac, digest, MAC_LEN);
+
+abort:
+    psa_hash_abort(&inner);
+    psa_hash_abort(&outer);
+    return err;
+}
+#endif // CONFIG_CRYPTO_HMAC_MIDSTATE
+
+#if defined(CONFIG_CRYPTO_VOLATILE_KEY_CACHE)
+static psa_status_t key_copy_load(key_copy_t *c, psa_key_id_t key_id) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    psa_status_t err;
+
+    if (c->key_id != 0 && c->status == PSA_SUCCESS && c->copy_id != c->key_id)
+        psa_destroy_key(c->copy_id);
+    c->key_id = key_id;
+    c->copy_id = key_id;
+
+    err = psa_get_key_attributes(key_id, &attributes);
+    if (err == PSA_SUCCESS &&
+        !PSA_KEY_LIFETIME_IS_VOLATILE(psa_get_key_lifetime(&attributes))) {
+        psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_VOLATILE);
+        err = psa_copy_key(key_id, &attributes, &c->copy_id);
+    }
+
+    psa_reset_key_attributes(&attributes);
+    c->status = err;
+    return err;
+}
+
+static psa_key_id_t key_acquire(psa_key_id_t key_id) {
+    key_copy_t *c = &key_copies[key_id % ARRAY_SIZE(key_copies)];
+    psa_status_t err;
 
-    return psa_import_key(&attributes, (uint8_t *)&ctx->value,
-                          sizeof(ctx->storage_uid), &ret_id);
+    k_mutex_lock(&key_copy_mutex, K_FOREVER);
+    err = c->key_id == key_id ? c->status : key_copy_load(c, key_id);
+    return err == PSA_SUCCESS ? c->copy_id : key_id;
 }
+#endif // CONFIG_CRYPTO_VOLATILE_KEY_CACHE
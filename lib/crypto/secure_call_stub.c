@@ -0,0 +1,31 @@
+#include <app/lib/crypto.h>
+#include <native_rtc.h>
+#include <zephyr/sys/atomic.h>
+
+#include "secure_call_stub.h"
+
+static atomic_t secure_calls;
+
+/**
+ * \brief Spins on host time, native_sim's k_busy_wait only moves the
+ * simulated clock.
+ */
+static void host_busy_wait(uint32_t us) {
+    uint64_t end =
+        native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME) + us;
+
+    while (native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME) < end)
+        ;
+}
+
+void secure_call_stub_enter(psa_key_id_t key_id) {
+    uint32_t us = CONFIG_CRYPTO_SECURE_CALL_STUB_US;
+
+    if (key_id >= PSA_KEY_ID_USER_MIN && key_id <= PSA_KEY_ID_USER_MAX)
+        us += CONFIG_CRYPTO_SECURE_CALL_STUB_KEY_LOAD_US;
+
+    atomic_inc(&secure_calls);
+    host_busy_wait(us);
+}
+
+uint32_t crypto_secure_call_count(void) { return atomic_get(&secure_calls); }
@@ -0,0 +1,13 @@
+#ifndef SECURE_CALL_STUB_H
+#define SECURE_CALL_STUB_H
+
+#include <psa/crypto.h>
+
+/**
+ * \brief Spends the modelled cost of one call into the secure side.
+ * Persistent keys add CONFIG_CRYPTO_SECURE_CALL_STUB_KEY_LOAD_US for reading
+ * the key from ITS, volatile keys are already loaded.
+ */
+void secure_call_stub_enter(psa_key_id_t key_id);
+
+#endif // SECURE_CALL_STUB_H
@@ -1,17 +1,219 @@
 #include <app/lib/transfer.h>
 
 static SERIALIZER_DECLARE(register_data_serialize, register_data_t);
+static SERIALIZER_DECLARE(ack_set_serialize, ack_set_t);
 inline static SERIALIZER_DECLARE(counter_serialize, uint64_t);
 
 static DESERIALIZER_DECLARE(register_data_deserialize, register_data_t);
+static DESERIALIZER_DECLARE(ack_set_deserialize, ack_set_t);
 inline static DESERIALIZER_DECLARE(counter_deserialize, uint64_t);
 
+static uint8_t ack_bitmap_rank(const uint8_t *bitmap, uint8_t rsp_slot);
+
+static transfer_error_t sign_full(struct net_buf_simple *serialized,
+                                  size_t header_len, psa_key_id_t key_id);
+static transfer_error_t verify_full(struct net_buf_simple *message,
+                                    size_t header_len, psa_key_id_t key_id,
+                                    replay_window_t *window);
+
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+/**
+ * \brief Drops the high counter bytes of a signed message.
+ * The counter is followed by trailer_len bytes of tag, and proof with batch
+ * signing, which move down over the dropped bytes.
+ */
+static void counter_truncate(struct net_buf_simple *message,
+                             size_t trailer_len) {
+    uint8_t *trailer = message->data + message->len - trailer_len;
+
+    memmove(trailer - COUNTER_WIRE_SLACK, trailer, trailer_len);
+    message->len -= COUNTER_WIRE_SLACK;
+}
+
+/**
+ * \brief Puts back the counter bytes counter_truncate dropped, expanded
+ * around reference.
+ * The tag was received in the room the dropped bytes need, so there is always
+ * enough tailroom for a message the size of the one sent.
+ */
+static transfer_error_t counter_restore(struct net_buf_simple *message,
+                                        size_t header_len, size_t trailer_len,
+                                        uint64_t reference) {
+    uint8_t *counter;
+    uint64_t wire;
+
+    if (message->len < header_len + COUNTER_WIRE_LEN + trailer_len ||
+        net_buf_simple_tailroom(message) < COUNTER_WIRE_SLACK)
+        return TRANSFER_MESSAGE_TO_SHORT;
+
+    counter = message->data + message->len - trailer_len - COUNTER_WIRE_LEN;
+    wire = COUNTER_WIRE_LEN == sizeof(uint16_t) ? sys_get_le16(counter)
+                                                : sys_get_le32(counter);
+    memmove(counter + sizeof(uint64_t), counter + COUNTER_WIRE_LEN,
+            trailer_len);
+    sys_put_le64(counter_from_wire(wire, reference), counter);
+    message->len += COUNTER_WIRE_SLACK;
+    return TRANSFER_NO_ERROR;
+}
+#else
+static inline void counter_truncate(struct net_buf_simple *message,
+                                    size_t trailer_len) {}
+static inline transfer_error_t counter_restore(struct net_buf_simple *message,
+                                               size_t header_len,
+                                               size_t trailer_len,
+                                               uint64_t reference) {
+    return TRANSFER_NO_ERROR;
+}
+#endif // CONFIG_TRANSFER_COMPACT_FRAMING
+
+static inline transfer_error_t counter_accept(uint64_t remote_counter,
+                                              replay_window_t *window) {
+    transfer_error_t err = replay_window_check(window, remote_counter);
+
+    if (err == TRANSFER_NO_ERROR)
+        replay_window_accept(window, remote_counter);
+    return err;
+}
+
+uint64_t counter_from_wire(uint64_t wire, uint64_t reference) {
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+    const uint64_t range = BIT64(CONFIG_TRANSFER_COUNTER_WIRE_BITS);
+    uint64_t counter = (reference & ~(range - 1)) | (wire & (range - 1));
+
+    // Closest to reference, at most half the range either way
+    if (counter + range / 2 <= reference)
+        counter += range;
+    else if (counter > reference + range / 2 && counter >= range)
+        counter -= range;
+    return counter;
+#else
+    ARG_UNUSED(reference);
+    return wire;
+#endif // CONFIG_TRANSFER_COMPACT_FRAMING
+}
+
+void replay_window_init(replay_window_t *window, uint64_t newest) {
+    window->newest = newest;
+    // Counters below newest may have been accepted before, e.g. before a reset
+    window->seen = UINT64_MAX << 1;
+}
+
+transfer_error_t replay_window_check(const replay_window_t *window,
+                                     uint64_t counter) {
+    uint64_t age;
+
+    if (counter > window->newest)
+        return TRANSFER_NO_ERROR;
+
+    age = window->newest - counter;
+    if (age >= REPLAY_WINDOW_LEN || (window->seen & BIT64(age)))
+        return TRANSFER_COUNTER_DIDNT_MATCH;
+    return TRANSFER_NO_ERROR;
+}
+
+void replay_window_raise(replay_window_t *window, uint64_t floor) {
+    if (floor > window->newest)
+        replay_window_init(window, floor);
+}
+
+void replay_window_accept(replay_window_t *window, uint64_t counter) {
+    uint64_t shift;
+
+    if (counter > window->newest) {
+        shift = counter - window->newest;
+        window->seen = shift >= REPLAY_WINDOW_LEN ? 0 : window->seen << shift;
+        window->seen |= BIT64(0);
+        window->newest = counter;
+        return;
+    }
+
+    window->seen |= BIT64(window->newest - counter);
+}
+
 transfer_error_t sign_message(struct net_buf_simple *serialized,
                               psa_key_id_t key_id) {
+    return sign_full(serialized, 0, key_id);
+}
+
+transfer_error_t verify_message(struct net_buf_simple *message,
+                                psa_key_id_t key_id, replay_window_t *window) {
+    return verify_full(message, 0, key_id, window);
+}
+
+transfer_error_t sign_message_with_header(struct net_buf_simple *serialized,
+                                          size_t header_len,
+                                          psa_key_id_t key_id) {
+    transfer_error_t err = sign_full(serialized, header_len, key_id);
+
+    if (err == TRANSFER_NO_ERROR)
+        counter_truncate(serialized, HASH_LEN);
+    return err;
+}
+
+transfer_error_t verify_message_with_header(struct net_buf_simple *message,
+                                            size_t header_len,
+                                            psa_key_id_t key_id,
+                                            replay_window_t *window) {
+    transfer_error_t err;
+
+    err = counter_restore(message, header_len, HASH_LEN, window->newest);
+    if (err != TRANSFER_NO_ERROR)
+        return err;
+    return verify_full(message, header_len, key_id, window);
+}
+
+#if defined(CRYPTO_AEAD)
+static transfer_error_t sign_full(struct net_buf_simple *serialized,
+                                  size_t header_len, psa_key_id_t key_id) {
+    psa_status_t err;
+    size_t payload_len = serialized->len - header_len - sizeof(uint64_t);
+    uint64_t counter = sys_get_le64(serialized->data + header_len + payload_len);
+    uint8_t *tag = net_buf_simple_add(serialized, HASH_LEN);
+
+    // Counter is the nonce, so it's authenticated without being in ad
+    err = crypto_aead_seal(key_id, counter, serialized->data, header_len,
+                           serialized->data + header_len, payload_len, tag);
+    return err == PSA_SUCCESS ? TRANSFER_NO_ERROR
+                              : TRANSFER_COULDNT_COMPUTE_MAC;
+}
+
+static transfer_error_t verify_full(struct net_buf_simple *message,
+                                    size_t header_len, psa_key_id_t key_id,
+                                    replay_window_t *window) {
+    psa_status_t err;
+    transfer_error_t transfer_err;
+    uint8_t *tag;
+    uint64_t remote_counter;
+
+    if (message->len < header_len + sizeof(uint64_t) + HASH_LEN)
+        return TRANSFER_MESSAGE_TO_SHORT;
+
+    tag = net_buf_simple_remove_mem(message, HASH_LEN);
+    if ((transfer_err = counter_deserialize(&remote_counter, message)) !=
+        TRANSFER_NO_ERROR) {
+        return transfer_err;
+    }
+
+    err = crypto_aead_open(key_id, remote_counter, message->data, header_len,
+                           message->data + header_len,
+                           message->len - header_len, tag);
+    if (err == PSA_ERROR_INVALID_SIGNATURE)
+        return TRANSFER_INVALID_HASH;
+    if (err != PSA_SUCCESS)
+        return TRANSFER_COULDNT_COMPUTE_MAC;
+
+    return counter_accept(remote_counter, window);
+}
+#else
+static transfer_error_t sign_full(struct net_buf_simple *serialized,
+                                  size_t header_len, psa_key_id_t key_id) {
     psa_status_t err;
     struct net_buf_simple hmac;
     size_t hashable_len = serialized->len;
 
+    // The header is covered by the MAC like the rest of the message
+    ARG_UNUSED(header_len);
+
     net_buf_simple_init_with_data(
         &hmac, net_buf_simple_add(serialized, HASH_LEN), HASH_LEN);
 
@@ -21,15 +223,16 @@ transfer_error_t sign_message(struct net_buf_simple *serialized,
                               : TRANSFER_COULDNT_COMPUTE_MAC;
 }
 
-transfer_error_t verify_message(struct net_buf_simple *message,
-                                psa_key_id_t key_id, uint64_t *counter) {
+static transfer_error_t verify_full(struct net_buf_simple *message,
+                                    size_t header_len, psa_key_id_t key_id,
+                                    replay_window_t *window) {
     psa_status_t err;
     transfer_error_t transfer_err;
     struct net_buf_simple hmac;
     uint64_t remote_counter;
     CRYPTO_MAC_BUF_DEFINE(hmac_self_signed);
 
-    if (message->len < HASH_LEN)
+    if (message->len < header_len + HASH_LEN)
         return TRANSFER_MESSAGE_TO_SHORT;
 
     net_buf_simple_init_with_data(
@@ -47,15 +250,297 @@ transfer_error_t verify_message(struct net_buf_simple *message,
         return transfer_err;
     }
 
-    if (remote_counter < *counter)
-        return TRANSFER_COUNTER_DIDNT_MATCH;
+    return counter_accept(remote_counter, window);
+}
+#endif // CRYPTO_AEAD
+
+transfer_error_t peek_message_counter(const struct net_buf_simple *message,
+                                      size_t header_len, uint64_t reference,
+                                      uint64_t *counter) {
+    const uint8_t *wire;
+
+    if (message->len < header_len + COUNTER_WIRE_LEN + HASH_LEN)
+        return TRANSFER_MESSAGE_TO_SHORT;
+
+    wire = message->data + message->len - HASH_LEN - COUNTER_WIRE_LEN;
+    switch (COUNTER_WIRE_LEN) {
+    case sizeof(uint16_t):
+        *counter = counter_from_wire(sys_get_le16(wire), reference);
+        break;
+    case sizeof(uint32_t):
+        *counter = counter_from_wire(sys_get_le32(wire), reference);
+        break;
+    default:
+        *counter = sys_get_le64(wire);
+        break;
+    }
+    return TRANSFER_NO_ERROR;
+}
+
+/** Jobs passed to crypto_compute_mac_batch at once by sign_messages */
+#define SIGN_MESSAGES_CHUNK 8
+
+transfer_error_t sign_messages(struct net_buf_simple *messages[], size_t count,
+                               psa_key_id_t key_id) {
+#if defined(CRYPTO_AEAD)
+    transfer_error_t err;
+
+    for (size_t i = 0; i < count; i++) {
+        if ((err = sign_full(messages[i], 0, key_id)) != TRANSFER_NO_ERROR)
+            return err;
+        counter_truncate(messages[i], HASH_LEN);
+    }
+    return TRANSFER_NO_ERROR;
+#else
+    crypto_mac_job_t jobs[SIGN_MESSAGES_CHUNK];
+    size_t n;
+
+    for (size_t i = 0; i < count; i += n) {
+        n = MIN(count - i, ARRAY_SIZE(jobs));
+        for (size_t j = 0; j < n; j++) {
+            struct net_buf_simple *m = messages[i + j];
+
+            jobs[j].input = m->data;
+            jobs[j].input_len = m->len;
+            jobs[j].mac = net_buf_simple_add(m, HASH_LEN);
+        }
+        if (crypto_compute_mac_batch(key_id, jobs, n) != PSA_SUCCESS)
+            return TRANSFER_COULDNT_COMPUTE_MAC;
+        for (size_t j = 0; j < n; j++)
+            counter_truncate(messages[i + j], HASH_LEN);
+    }
+    return TRANSFER_NO_ERROR;
+#endif // CRYPTO_AEAD
+}
+
+transfer_error_t verify_subevent_message(struct net_buf_simple *message,
+                                         uint8_t subevent, psa_key_id_t key_id,
+                                         replay_window_t *window) {
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+    return verify_message_batch(message, subevent, key_id, window);
+#else
+    transfer_error_t err;
+
+    ARG_UNUSED(subevent);
+    err = counter_restore(message, 0, HASH_LEN, window->newest);
+    if (err != TRANSFER_NO_ERROR)
+        return err;
+    return verify_full(message, 0, key_id, window);
+#endif
+}
+
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+#define BATCH_LEAF_PREFIX 0x00
+#define BATCH_NODE_PREFIX 0x01
+
+/**
+ * \brief Truncated SHA-256 of prefix || a || b.
+ * Leaves and inner nodes get different prefixes, so a message can't be passed
+ * off as a pair of nodes. A leaf is the subevent number followed by the
+ * message.
+ */
+static psa_status_t batch_hash(uint8_t prefix, const uint8_t *a, size_t a_len,
+                               const uint8_t *b, size_t b_len, uint8_t *out) {
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t digest[PSA_HASH_LENGTH(PSA_ALG_SHA_256)];
+    size_t len;
+    psa_status_t err;
+
+    err = psa_hash_setup(&op, PSA_ALG_SHA_256);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_update(&op, &prefix, sizeof(prefix));
+    if (err == PSA_SUCCESS)
+        err = psa_hash_update(&op, a, a_len);
+    if (err == PSA_SUCCESS && b_len)
+        err = psa_hash_update(&op, b, b_len);
+    if (err == PSA_SUCCESS)
+        err = psa_hash_finish(&op, digest, sizeof(digest), &len);
+    if (err != PSA_SUCCESS) {
+        psa_hash_abort(&op);
+        return err;
+    }
+
+    memcpy(out, digest, BATCH_NODE_LEN);
+    return PSA_SUCCESS;
+}
 
-    if (remote_counter > *counter)
-        *counter = remote_counter;
+static psa_status_t batch_root_mac(psa_key_id_t key_id, uint8_t *root,
+                                   uint8_t *mac) {
+    struct net_buf_simple root_buf, mac_buf;
 
+    net_buf_simple_init_with_data(&root_buf, root, BATCH_NODE_LEN);
+    net_buf_simple_init_with_data(&mac_buf, mac, HASH_LEN);
+    net_buf_simple_reset(&mac_buf);
+    return crypto_compute_mac(key_id, &root_buf, BATCH_NODE_LEN, &mac_buf);
+}
+
+transfer_error_t sign_message_batch(struct net_buf_simple *messages[BATCH_SIZE],
+                                    uint8_t first_subevent,
+                                    psa_key_id_t key_id) {
+    // Heap layout, root at 1 and leaf i at BATCH_SIZE + i
+    uint8_t tree[2 * BATCH_SIZE][BATCH_NODE_LEN];
+    uint8_t mac[HASH_LEN];
+    struct net_buf_simple *m;
+    uint8_t subevent;
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        m = messages[i];
+        subevent = first_subevent + i;
+        // Subevents which aren't sent get an all zero leaf
+        if (!m) {
+            memset(tree[BATCH_SIZE + i], 0, BATCH_NODE_LEN);
+            continue;
+        }
+        if (batch_hash(BATCH_LEAF_PREFIX, &subevent, sizeof(subevent),
+                       m->data, m->len, tree[BATCH_SIZE + i]) != PSA_SUCCESS)
+            return TRANSFER_COULDNT_COMPUTE_MAC;
+    }
+    for (size_t n = BATCH_SIZE - 1; n > 0; n--) {
+        if (batch_hash(BATCH_NODE_PREFIX, tree[2 * n], BATCH_NODE_LEN,
+                       tree[2 * n + 1], BATCH_NODE_LEN,
+                       tree[n]) != PSA_SUCCESS)
+            return TRANSFER_COULDNT_COMPUTE_MAC;
+    }
+    if (batch_root_mac(key_id, tree[1], mac) != PSA_SUCCESS)
+        return TRANSFER_COULDNT_COMPUTE_MAC;
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        m = messages[i];
+        if (!m)
+            continue;
+        // Siblings from the leaf up to below the root
+        for (size_t n = BATCH_SIZE + i; n > 1; n >>= 1)
+            net_buf_simple_add_mem(m, tree[n ^ 1], BATCH_NODE_LEN);
+        net_buf_simple_add_mem(m, mac, HASH_LEN);
+        counter_truncate(m, BATCH_PROOF_LEN + HASH_LEN);
+    }
     return TRANSFER_NO_ERROR;
 }
 
+transfer_error_t verify_message_batch(struct net_buf_simple *message,
+                                      uint8_t subevent, psa_key_id_t key_id,
+                                      replay_window_t *window) {
+    uint8_t index = subevent % BATCH_SIZE;
+    transfer_error_t transfer_err;
+    uint8_t node[BATCH_NODE_LEN], mac[HASH_LEN];
+    uint8_t *tag, *proof;
+    uint64_t remote_counter;
+
+    transfer_err = counter_restore(message, 0, BATCH_PROOF_LEN + HASH_LEN,
+                                   window->newest);
+    if (transfer_err != TRANSFER_NO_ERROR)
+        return transfer_err;
+    if (message->len < sizeof(uint64_t) + BATCH_PROOF_LEN + HASH_LEN)
+        return TRANSFER_MESSAGE_TO_SHORT;
+
+    tag = net_buf_simple_remove_mem(message, HASH_LEN);
+    proof = net_buf_simple_remove_mem(message, BATCH_PROOF_LEN);
+
+    if (batch_hash(BATCH_LEAF_PREFIX, &subevent, sizeof(subevent),
+                   message->data, message->len, node) != PSA_SUCCESS)
+        return TRANSFER_COULDNT_COMPUTE_MAC;
+    for (size_t n = BATCH_SIZE + index, i = 0; n > 1; n >>= 1, i++) {
+        const uint8_t *sibling = proof + i * BATCH_NODE_LEN;
+        psa_status_t err =
+            n & 1 ? batch_hash(BATCH_NODE_PREFIX, sibling, BATCH_NODE_LEN,
+                               node, BATCH_NODE_LEN, node)
+                  : batch_hash(BATCH_NODE_PREFIX, node, BATCH_NODE_LEN,
+                               sibling, BATCH_NODE_LEN, node);
+        if (err != PSA_SUCCESS)
+            return TRANSFER_COULDNT_COMPUTE_MAC;
+    }
+
+    if (batch_root_mac(key_id, node, mac) != PSA_SUCCESS)
+        return TRANSFER_COULDNT_COMPUTE_MAC;
+    if (memcmp(tag, mac, HASH_LEN) != 0)
+        return TRANSFER_INVALID_HASH;
+
+    if ((transfer_err = counter_deserialize(&remote_counter, message)) !=
+        TRANSFER_NO_ERROR) {
+        return transfer_err;
+    }
+    return counter_accept(remote_counter, window);
+}
+#endif // CONFIG_TRANSFER_BATCH_SIGNING
+
+static inline bool ack_bitmap_test(const uint8_t *bitmap, uint8_t rsp_slot) {
+    return bitmap[rsp_slot / BITS_PER_BYTE] & BIT(rsp_slot % BITS_PER_BYTE);
+}
+
+void ack_set_init(ack_set_t *acks) {
+    memset(acks->bitmap, 0, sizeof(acks->bitmap));
+    acks->count = 0;
+}
+
+transfer_error_t ack_set_add(ack_set_t *acks, uint8_t rsp_slot,
+                             uint16_t ack_id) {
+    if (acks->count == ACK_MAX_IDS)
+        return TRANSFER_TOO_MANY_ACKS;
+
+    acks->bitmap[rsp_slot / BITS_PER_BYTE] |= BIT(rsp_slot % BITS_PER_BYTE);
+    acks->ids[acks->count++] = ack_id;
+    return TRANSFER_NO_ERROR;
+}
+
+uint16_t ack_set_get(const ack_set_t *acks, uint8_t rsp_slot) {
+    if (rsp_slot >= NUM_RSP_SLOTS || !ack_bitmap_test(acks->bitmap, rsp_slot))
+        return 0;
+    return acks->ids[ack_bitmap_rank(acks->bitmap, rsp_slot)];
+}
+
+transfer_error_t subevent_view_init(subevent_view_t *view,
+                                    const struct net_buf_simple *data,
+                                    uint8_t register_data_count) {
+    const uint8_t *end = data->data + data->len;
+    size_t ids_len, register_data_len;
+
+    DESERIALIZER_SIZE_GUARD(ACK_BITMAP_LEN);
+    view->bitmap = end - ACK_BITMAP_LEN;
+
+    view->ack_count = ack_bitmap_rank(view->bitmap, NUM_RSP_SLOTS);
+    if (view->ack_count > ACK_MAX_IDS)
+        return TRANSFER_TOO_MANY_ACKS;
+
+    ids_len = sizeof(uint16_t) * view->ack_count;
+    register_data_len = sizeof(register_data_t) * register_data_count;
+    DESERIALIZER_SIZE_GUARD(ACK_BITMAP_LEN + ids_len + register_data_len);
+    view->ids = view->bitmap - ids_len;
+    view->register_data = view->ids - register_data_len;
+    view->register_data_count = register_data_count;
+    return 0;
+}
+
+uint16_t subevent_view_ack(const subevent_view_t *view, uint8_t rsp_slot) {
+    if (rsp_slot >= NUM_RSP_SLOTS || !ack_bitmap_test(view->bitmap, rsp_slot))
+        return 0;
+    return sys_get_le16(view->ids +
+                        sizeof(uint16_t) *
+                            ack_bitmap_rank(view->bitmap, rsp_slot));
+}
+
+register_data_t subevent_view_register_data(const subevent_view_t *view,
+                                            uint8_t index) {
+    const uint8_t *entry =
+        view->register_data + sizeof(register_data_t) * index;
+
+    return (register_data_t){.subevent = entry[0], .rsp_slot = entry[1]};
+}
+
+bool subevent_view_next_ack(const subevent_view_t *view,
+                            subevent_view_iter_t *iter, uint8_t *rsp_slot,
+                            uint16_t *ack_id) {
+    while (iter->rsp_slot < NUM_RSP_SLOTS) {
+        uint8_t slot = iter->rsp_slot++;
+
+        if (!ack_bitmap_test(view->bitmap, slot))
+            continue;
+        *rsp_slot = slot;
+        *ack_id = sys_get_le16(view->ids + sizeof(uint16_t) * iter->index++);
+        return true;
+    }
+    return false;
+}
+
 SERIALIZER_DEFINE(advertisement_data_serialize, advertisement_data_t) {
     for (size_t i = 0; i < data->selection_info.num_reg_slots; i++) {
         register_data_serialize(&data->reg_data[i], result);
@@ -68,23 +553,49 @@ SERIALIZER_DEFINE(subevent_data_with_reg_serialize, subevent_data_t) {
     for (size_t i = 0; i < data->_register_data_count; i++) {
         register_data_serialize(&data->register_data[i], result);
     }
-    for (size_t i = 0; i < data->_ack_data_count; i++) {
-        net_buf_simple_add_le16(result, data->ack_data[i].ack_id);
-    }
+    ack_set_serialize(data->acks, result);
 
     counter_serialize(&data->counter, result);
 }
 
 SERIALIZER_DEFINE(subevent_data_serialize, subevent_data_t) {
-    for (size_t i = 0; i < data->_ack_data_count; i++) {
-        net_buf_simple_add_le16(result, data->ack_data[i].ack_id);
-    }
+    ack_set_serialize(data->acks, result);
     counter_serialize(&data->counter, result);
 }
 
+size_t response_header_len(const struct net_buf_simple *response) {
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+    if (response->len == 0 ||
+        (response->data[0] & RESPONSE_FLAG_SENDER_ID))
+        return RESPONSE_HEADER_LEN;
+    return sizeof(uint8_t);
+#else
+    ARG_UNUSED(response);
+    return RESPONSE_HEADER_LEN;
+#endif
+}
+
+bool response_sender_id(const struct net_buf_simple *response,
+                        uint16_t *sender_id) {
+    size_t offset = RESPONSE_HEADER_LEN - sizeof(uint16_t);
+
+    if (response_header_len(response) != RESPONSE_HEADER_LEN ||
+        response->len < RESPONSE_HEADER_LEN)
+        return false;
+
+    *sender_id = sys_get_le16(response->data + offset);
+    return true;
+}
+
 SERIALIZER_DEFINE(response_data_serialize, response_data_t) {
+#if defined(CONFIG_TRANSFER_COMPACT_FRAMING)
+    net_buf_simple_add_u8(result,
+                          data->sender_in_slot ? 0 : RESPONSE_FLAG_SENDER_ID);
+    if (!data->sender_in_slot)
+        net_buf_simple_add_le16(result, data->rsp_metadata.sender_id);
+#else
     net_buf_simple_add_le16(result, data->rsp_metadata.sender_id);
-    net_buf_simple_add_le32(result, data->rsp_metadata.counter);
+#endif
     net_buf_simple_add_mem(result, data->data, data->data_len);
     net_buf_simple_add_u8(result, data->data_len);
 
@@ -104,10 +615,8 @@ DESERIALIZER_DEFINE(advertisement_data_deserialize, advertisement_data_t) {
 
 DESERIALIZER_DEFINE(subevent_data_with_reg_deserialize, subevent_data_t) {
     transfer_error_t err;
-    DESERIALIZER_SIZE_GUARD(2 * result->_ack_data_count);
-    for (size_t i = result->_ack_data_count; i > 0; i--) {
-        result->ack_data[i - 1].ack_id = net_buf_simple_remove_le16(data);
-    }
+    if ((err = ack_set_deserialize(result->acks, data)) != 0)
+        return err;
 
     for (size_t i = result->_register_data_count; i > 0; i--) {
         if ((err = register_data_deserialize(&result->register_data[i - 1],
@@ -118,22 +627,20 @@ DESERIALIZER_DEFINE(subevent_data_with_reg_deserialize, subevent_data_t) {
 }
 
 DESERIALIZER_DEFINE(subevent_data_deserialize, subevent_data_t) {
-    DESERIALIZER_SIZE_GUARD(2 * result->_ack_data_count);
-    for (size_t i = result->_ack_data_count; i > 0; i--) {
-        result->ack_data[i - 1].ack_id = net_buf_simple_remove_le16(data);
-    }
-    return 0;
+    return ack_set_deserialize(result->acks, data);
 }
 
 DESERIALIZER_DEFINE(response_data_deserialize, response_data_t) {
+    // Without the id in the header the receiver knows the sender from the slot
+    uint16_t sender_id = 0;
+
     DESERIALIZER_SIZE_GUARD(1);
     result->data_len = net_buf_simple_remove_u8(data);
 
-    DESERIALIZER_SIZE_GUARD(result->data_len + 2 + 4);
+    DESERIALIZER_SIZE_GUARD(result->data_len + response_header_len(data));
     result->data = net_buf_simple_remove_mem(data, result->data_len);
-    
-    result->rsp_metadata.counter = net_buf_simple_remove_le32(data);
-    result->rsp_metadata.sender_id = net_buf_simple_remove_le16(data);
+    response_sender_id(data, &sender_id);
+    result->rsp_metadata.sender_id = sender_id;
     return 0;
 }
 
@@ -142,6 +649,13 @@ static SERIALIZER_DEFINE(register_data_serialize, register_data_t) {
     net_buf_simple_add_u8(result, data->rsp_slot);
 }
 
+static SERIALIZER_DEFINE(ack_set_serialize, ack_set_t) {
+    for (size_t i = 0; i < data->count; i++) {
+        net_buf_simple_add_le16(result, data->ids[i]);
+    }
+    net_buf_simple_add_mem(result, data->bitmap, ACK_BITMAP_LEN);
+}
+
 static SERIALIZER_DEFINE(counter_serialize, uint64_t) {
     net_buf_simple_add_le64(result, *data);
 }
@@ -158,3 +672,36 @@ static DESERIALIZER_DEFINE(register_data_deserialize, register_data_t) {
     result->subevent = net_buf_simple_remove_u8(data);
     return 0;
 }
+
+static DESERIALIZER_DEFINE(ack_set_deserialize, ack_set_t) {
+    DESERIALIZER_SIZE_GUARD(ACK_BITMAP_LEN);
+    memcpy(result->bitmap, net_buf_simple_remove_mem(data, ACK_BITMAP_LEN),
+           ACK_BITMAP_LEN);
+
+    size_t count = ack_bitmap_rank(result->bitmap, NUM_RSP_SLOTS);
+    if (count > ACK_MAX_IDS)
+        return TRANSFER_TOO_MANY_ACKS;
+
+    DESERIALIZER_SIZE_GUARD(2 * count);
+    result->count = count;
+    for (size_t i = count; i > 0; i--) {
+        result->ids[i - 1] = net_buf_simple_remove_le16(data);
+    }
+    return 0;
+}
+
+/**
+ * Number of acked slots before rsp_slot, which is the index of rsp_slot's id.
+ */
+static uint8_t ack_bitmap_rank(const uint8_t *bitmap, uint8_t rsp_slot) {
+    uint8_t rank = 0;
+    size_t full_bytes = rsp_slot / BITS_PER_BYTE;
+
+    for (size_t i = 0; i < full_bytes; i++) {
+        rank += __builtin_popcount(bitmap[i]);
+    }
+    if (rsp_slot % BITS_PER_BYTE)
+        rank += __builtin_popcount(bitmap[full_bytes] &
+                                   (BIT(rsp_slot % BITS_PER_BYTE) - 1));
+    return rank;
+}
@@ -7,39 +7,21 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define STATS "[STATS] "
 
 #define SCALE_INTERVAL_TO_TIMEOUT(interval) (interval * 5 / 40)
-#define NUM_RSP_SLOTS 103
 
+#if defined(CONFIG_SCANNER_SIM)
 /**
- * Enum for states of this fsm.
+ * One line per event for tests/bsim/pawr/report.py:
+ * SIM,scanner_id,uptime_us,event[,data_seq]
  */
-typedef enum {
-    INITIALIZE,
-    FAULT_HANDLING,
-    SYNCING,
-    REGISTERING,
-    CONFIRMING,
-    SLEEPING,
-    ENABLED,
-    NUM_STATES
-} state_t;
+#define SIM_REPORT(scanner, event, ...)                                        \
+    printk("SIM,%u,%llu," event "\n", (scanner)->id,                           \
+           (unsigned long long)k_ticks_to_us_floor64(k_uptime_ticks()),        \
+           ##__VA_ARGS__)
+#else
+#define SIM_REPORT(scanner, event, ...)
+#endif
 
-/**
- * Enum for faults/events that can happen during fsm cycle.
- */
-typedef enum {
-    EVT_NO_FAULT,
-    EVT_BLE_ENABLE_FAILED,
-    EVT_BLE_SCAN_START_FAILED,
-    EVT_BLE_SYNC_TIMEOUT,
-    EVT_BLE_SYNC_DELETED,
-    EVT_CONFIRMATION_FAILED,
-    EVT_DIDNT_RECEIVE_ACK,
-    EVT_DATA_GENERATED,
-    EVT_GOT_ACK,
-    EVT_INVALID_HASH
-} evt_t;
-
-typedef state_t state_func();
+typedef state_t state_func(scanner_t *scanner);
 
 /**
  * Struct for data returned from advertisement.
@@ -50,6 +32,15 @@ typedef struct __attribute__((__packed__)) {
     uint8_t flags;
 } excepted_data_t;
 
+/**
+ * \brief Scanner whose adv data is being parsed and the error of verifying
+ * it.
+ */
+typedef struct {
+    scanner_t *scanner;
+    int err;
+} adv_parse_t;
+
 static void sync_cb(struct bt_le_per_adv_sync *sync,
                     struct bt_le_per_adv_sync_synced_info *info);
 
@@ -61,13 +52,21 @@ static void sync_cb(struct bt_le_per_adv_sync *sync,
 static void term_cb(struct bt_le_per_adv_sync *sync,
                     const struct bt_le_per_adv_sync_term_info *info);
 
+/**
+ * \brief Hands received data to the receive handler of the scanner owning
+ * sync.
+ */
+static void recv_cb(struct bt_le_per_adv_sync *sync,
+                    const struct bt_le_per_adv_sync_recv_info *info,
+                    struct net_buf_simple *buf);
+
 /**
  * \brief Callback for receiving data from advertiser during registration.
  * It replies in one of the slots available by sel_info. The slot is
  * choosen randomly. This is to hopefully not colide with other devices trying
  * to register at the same time.
  */
-static void register_recv_cb(struct bt_le_per_adv_sync *sync,
+static void register_recv_cb(scanner_t *scanner,
                              const struct bt_le_per_adv_sync_recv_info *info,
                              struct net_buf_simple *buf);
 /**
@@ -76,89 +75,152 @@ static void register_recv_cb(struct bt_le_per_adv_sync *sync,
  * back into registering mode. This could happen either because of interference
  * or other device taking the spot.
  */
-static void confirm_recv_cb(struct bt_le_per_adv_sync *sync,
+static void confirm_recv_cb(scanner_t *scanner,
                             const struct bt_le_per_adv_sync_recv_info *info,
                             struct net_buf_simple *buf);
 
 /**
  * Callback used for sending ack to advertiser
  */
-static void ack_recv_cb(struct bt_le_per_adv_sync *sync,
+static void ack_recv_cb(scanner_t *scanner,
                         const struct bt_le_per_adv_sync_recv_info *info,
                         struct net_buf_simple *buf);
 
 /**
  * \brief Callback used for initialising pawr.
- * When ext adv packet is handled it sets proper sync parameters.
+ * When ext adv packet is handled it sets proper sync parameters for every
+ * scanner waiting for one.
  */
 static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
                          struct net_buf_simple *buf);
 
 /**
- * \brief Sets the response data via bt_le_per_adv_set_response_data
- * Since we are always using the same data there is no need to repeat this
- * process each time.
+ * \brief Verifies the adv data in buf and creates the sync of scanner to the
+ * advertiser it came from.
+ *
+ * \return 0 on success, otherwise the sync is left for a later scan report
+ */
+static int scan_sync_create(scanner_t *scanner,
+                            const struct bt_le_scan_recv_info *info,
+                            struct net_buf_simple *buf);
+
+/**
+ * \brief Queues scanner for the next scan report, scanning starts with the
+ * first scanner queued and stops once none is left.
+ *
+ * \return 0 on success, otherwise error of bt_le_scan_start
+ */
+static int scan_join(scanner_t *scanner);
+
+/**
+ * \brief Enables Bluetooth and registers the callbacks shared by all scanners,
+ * for the first scanner only.
+ *
+ * \return 0 on success, otherwise error of bt_enable
+ */
+static int scanner_bt_enable();
+
+static void sync_owner_set(struct bt_le_per_adv_sync *sync,
+                           scanner_t *scanner);
+static scanner_t *sync_owner(struct bt_le_per_adv_sync *sync);
+
+/**
+ * \brief Deletes the sync of scanner, if it has one.
+ */
+static void sync_delete(scanner_t *scanner);
+
+/**
+ * \brief Signs resp and sets it as response data right away.
  *
  * \return 0 on success otherwies error returned by
  * bt_le_per_adv_set_response_data.
  */
-static int set_rsp_data(struct bt_le_per_adv_sync *sync,
+static int set_rsp_data(scanner_t *scanner,
                         const struct bt_le_per_adv_sync_recv_info *info,
                         response_data_t *resp);
 
 /**
- * Initialise response buffer with data
+ * \brief Sets the staged response as response data and stages the next one.
+ * Falls back to signing in place when nothing usable is staged.
+ *
+ * \return 0 on success otherwies error returned by
+ * bt_le_per_adv_set_response_data.
  */
-static void data_generated_cb();
+static int send_staged_rsp_data(scanner_t *scanner,
+                                const struct bt_le_per_adv_sync_recv_info *info);
 
-static state_t init();
-static state_t syncing();
-static state_t handle_fault();
-static state_t registering();
-static state_t confirming();
-static state_t sleeping();
-static state_t enabled();
+/**
+ * \brief Signs the next response with the next counter ahead of time.
+ * Only from the scanner thread while receiving is disabled, so ack_recv_cb
+ * never signs. Nothing is staged if the counter couldn't be committed.
+ */
+static void stage_rsp_data(scanner_t *scanner);
 
 /**
- * Runs current state as defined by current_state
- * \return Next state_t that should be processed
+ * \brief Serializes resp with the current counter and signs it into
+ * message_rsp_buf.
+ *
+ * \return false if the counter is past its lease and has to be
+ * committed first, nothing was signed then
  */
-static state_t run_state();
-static char *state_str(state_t s);
+static bool sign_rsp_data(scanner_t *scanner, response_data_t *resp);
 
-static state_func *const states[NUM_STATES] = {
-    [INITIALIZE] = &init,       [FAULT_HANDLING] = &handle_fault,
-    [SYNCING] = &syncing,       [REGISTERING] = &registering,
-    [CONFIRMING] = &confirming, [SLEEPING] = &sleeping,
-    [ENABLED] = &enabled};
+/**
+ * \brief Hands message_rsp_buf to the controller for the response slot.
+ */
+static int submit_rsp_data(scanner_t *scanner,
+                           const struct bt_le_per_adv_sync_recv_info *info);
 
 /**
- * Current state of fsm.
+ * \brief Moves the counter past the last signed response, flagging a commit
+ * when the lease runs low.
+ */
+static void consume_counter(scanner_t *scanner);
+/**
+ * \brief Raises the counter to newest, flagging a commit if that ran the lease
+ * low.
  */
-static state_t curr_state = INITIALIZE;
+static void raise_counter(scanner_t *scanner, uint64_t newest);
 /**
- * Reason why state exited
+ * \brief Commits the counter if it was flagged. Only from the scanner thread
+ * while no receive callback runs.
  */
-static atomic_t fault_reason = ATOMIC_INIT(EVT_NO_FAULT);
+static void commit_pending_counter(scanner_t *scanner);
+static void commit_counter(scanner_t *scanner);
 
 /**
- * Information about how to select subevent
+ * Initialise response buffer with data
  */
-static subevent_sel_info_t sel_info;
-static register_data_t selected_slot;
+static void data_generated_cb(data_generator_config_t *config);
 
 /**
- * Current ble sync object.
+ * \brief Verifies a subevent from the advertiser against adv_window and
+ * catches the own counter up with the advertiser's.
  */
-static struct bt_le_per_adv_sync *default_sync;
-static uint16_t sync_interval;
+static transfer_error_t verify_advertiser_subevent(scanner_t *scanner,
+                                                   struct net_buf_simple *buf,
+                                                   uint8_t subevent);
+
+static state_t init(scanner_t *scanner);
+static state_t syncing(scanner_t *scanner);
+static state_t handle_fault(scanner_t *scanner);
+static state_t registering(scanner_t *scanner);
+static state_t confirming(scanner_t *scanner);
+static state_t sleeping(scanner_t *scanner);
+static state_t enabled(scanner_t *scanner);
 
 /**
- * Netbuf for responses from message
+ * Runs current state as defined by current_state
+ * \return Next state_t that should be processed
  */
-NET_BUF_SIMPLE_DEFINE_STATIC(message_rsp_buf, 251);
-NET_BUF_SIMPLE_DEFINE_STATIC(random, UNUSED_DATA_LEN);
-static response_data_t response;
+static state_t run_state(scanner_t *scanner);
+static char *state_str(state_t s);
+
+static state_func *const states[NUM_STATES] = {
+    [INITIALIZE] = &init,       [FAULT_HANDLING] = &handle_fault,
+    [SYNCING] = &syncing,       [REGISTERING] = &registering,
+    [CONFIRMING] = &confirming, [SLEEPING] = &sleeping,
+    [ENABLED] = &enabled};
 
 /**
  * Parameters for scanning for ext adv packets.
@@ -170,31 +232,14 @@ static const struct bt_le_scan_param scan_param = {
     .window = 0x00A0,
 };
 
-K_SEM_DEFINE(synced_evt_sem, 0, 1);
-K_SEM_DEFINE(register_evt_sem, 0, 1);
-K_SEM_DEFINE(synced_sem, 0, 1);
-
-/**
- * Data which we send to advertiser.
- */
-static rsp_data_t rsp_data_i = {.sender_id = CONFIG_SCANNER_ID, .counter = 0};
-
 /**
- * \brief Number of consecutive uncofirmed responses in confirming state.
- * If this number reaches CONFIG_MAX_UNCONFIRMED_TICKS, the device will try to
- * register again.
- */
-static uint8_t unconfirmed_ticks = 0;
-
-/**
- * \brief Callbacks for periodic advertisment sync.
- * This can be changed in runtime depending on state.
- * Initial values are for syncing register state.
+ * \brief Callbacks for periodic advertisment sync, shared by all scanners.
+ * Received data goes to the handler of the scanner's current state.
  */
 static struct bt_le_per_adv_sync_cb sync_callbacks = {
     .synced = sync_cb,
     .term = term_cb,
-    .recv = NULL,
+    .recv = recv_cb,
 };
 
 static struct bt_le_scan_cb scan_callbacks = {
@@ -202,14 +247,20 @@ static struct bt_le_scan_cb scan_callbacks = {
     .timeout = NULL,
 };
 
-static data_generator_config_t generator_config = {
-    .data = &random,
-    .interval = CONFIG_BLOCK_TIME,
-    .init_buf = NULL,
-    .generated = &data_generated_cb,
-};
+K_MUTEX_DEFINE(bt_enable_mutex);
+static bool bt_enabled;
+
+/**
+ * Scanner of each sync, indexed by bt_le_per_adv_sync_get_index.
+ */
+static scanner_t *sync_owners[CONFIG_BT_PER_ADV_SYNC_MAX];
+static struct k_spinlock sync_owners_lock;
 
-static crypto_counter_t counter = {.storage_uid = COUNTER_ID};
+/**
+ * Scanners waiting for a scan report to sync to.
+ */
+static sys_slist_t scan_queue = SYS_SLIST_STATIC_INIT(&scan_queue);
+static struct k_spinlock scan_queue_lock;
 
 #ifdef CONFIG_INTERACTIVE
 // When building for boards we use the led defined here
@@ -219,23 +270,56 @@ static crypto_counter_t counter = {.storage_uid = COUNTER_ID};
 static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(SLAVE_LED_NODE, gpios);
 #endif
 
+static void sync_owner_set(struct bt_le_per_adv_sync *sync,
+                           scanner_t *scanner) {
+    k_spinlock_key_t key = k_spin_lock(&sync_owners_lock);
+
+    sync_owners[bt_le_per_adv_sync_get_index(sync)] = scanner;
+    k_spin_unlock(&sync_owners_lock, key);
+}
+
+static scanner_t *sync_owner(struct bt_le_per_adv_sync *sync) {
+    k_spinlock_key_t key = k_spin_lock(&sync_owners_lock);
+    scanner_t *scanner = sync_owners[bt_le_per_adv_sync_get_index(sync)];
+
+    k_spin_unlock(&sync_owners_lock, key);
+    return scanner;
+}
+
+static void sync_delete(scanner_t *scanner) {
+    struct bt_le_per_adv_sync *sync = scanner->sync;
+
+    if (!sync)
+        return;
+
+    // Terminating an established sync calls term_cb right away, which still
+    // has to find the scanner
+    bt_le_per_adv_sync_delete(sync);
+    sync_owner_set(sync, NULL);
+    scanner->sync = NULL;
+}
+
 static void sync_cb(struct bt_le_per_adv_sync *sync,
                     struct bt_le_per_adv_sync_synced_info *info) {
     struct bt_le_per_adv_sync_subevent_params params;
+    scanner_t *scanner = sync_owner(sync);
     uint8_t subevents[1];
     char le_addr[BT_ADDR_LE_STR_LEN];
     int err;
 
+    if (!scanner)
+        return;
+
     bt_addr_le_to_str(info->addr, le_addr, sizeof(le_addr));
     LOG_INF(INFO "Synced to %s with %d subevents", le_addr,
             info->num_subevents);
 
-    default_sync = sync;
+    scanner->sync = sync;
 
     params.properties = 0;
     params.num_subevents = 1;
     params.subevents = subevents;
-    subevents[0] = selected_slot.subevent;
+    subevents[0] = scanner->selected_slot.subevent;
 
     err = bt_le_per_adv_sync_subevent(sync, &params);
     if (err) {
@@ -247,52 +331,66 @@ static void sync_cb(struct bt_le_per_adv_sync *sync,
 
 static void term_cb(struct bt_le_per_adv_sync *sync,
                     const struct bt_le_per_adv_sync_term_info *info) {
+    scanner_t *scanner = sync_owner(sync);
     char le_addr[BT_ADDR_LE_STR_LEN];
 
+    if (!scanner)
+        return;
+
     bt_addr_le_to_str(info->addr, le_addr, sizeof(le_addr));
 
     LOG_WRN(INFO "Sync terminated (reason %d)", info->reason);
 
-    default_sync = NULL;
+    sync_owner_set(sync, NULL);
+    scanner->sync = NULL;
 
-    atomic_set(&fault_reason, EVT_BLE_SYNC_TIMEOUT);
+    atomic_set(&scanner->fault_reason, EVT_BLE_SYNC_TIMEOUT);
     if (info->reason == 22)
-        atomic_set(&fault_reason, EVT_BLE_SYNC_DELETED);
+        atomic_set(&scanner->fault_reason, EVT_BLE_SYNC_DELETED);
 
-    k_sem_give(&synced_evt_sem);
+    k_sem_give(&scanner->synced_evt_sem);
 }
 
-static void register_recv_cb(struct bt_le_per_adv_sync *sync,
+static void recv_cb(struct bt_le_per_adv_sync *sync,
+                    const struct bt_le_per_adv_sync_recv_info *info,
+                    struct net_buf_simple *buf) {
+    scanner_t *scanner = sync_owner(sync);
+    scanner_recv_t *recv;
+
+    if (!scanner)
+        return;
+
+    recv = scanner->recv;
+    if (recv)
+        recv(scanner, info, buf);
+}
+
+static void register_recv_cb(scanner_t *scanner,
                              const struct bt_le_per_adv_sync_recv_info *info,
                              struct net_buf_simple *buf) {
-    subevent_data_t subevent_data;
-    ack_data_t ack_data[NUM_RSP_SLOTS];
+    subevent_view_t view;
 
     int err;
 
-    subevent_data._register_data_count = 0;
-    subevent_data._ack_data_count = NUM_RSP_SLOTS;
-    subevent_data.ack_data = ack_data;
-
-    sync_callbacks.recv = NULL;
+    scanner->recv = NULL;
 
     if (buf && buf->len) {
 
-        err = verify_message(buf, ADVERTISER_KEY_ID, &counter.value);
+        err = verify_advertiser_subevent(scanner, buf, info->subevent);
         if (err != 0) {
             LOG_WRN(INFO "Failed to verify message");
-            atomic_set(&fault_reason, EVT_INVALID_HASH);
-            k_sem_give(&register_evt_sem);
+            atomic_set(&scanner->fault_reason, EVT_INVALID_HASH);
+            k_sem_give(&scanner->register_evt_sem);
             return;
         }
 
-        err = subevent_data_with_reg_deserialize(&subevent_data, buf);
+        err = subevent_view_init(&view, buf, 0);
         if (err) {
             LOG_WRN(INFO "Failed to deserialize message");
             return;
         }
 
-        k_sem_give(&register_evt_sem);
+        k_sem_give(&scanner->register_evt_sem);
     } else if (buf) {
         LOG_WRN(INFO "Received empty indication: subevent %d", info->subevent);
     } else {
@@ -301,61 +399,61 @@ static void register_recv_cb(struct bt_le_per_adv_sync *sync,
     }
 }
 
-static void confirm_recv_cb(struct bt_le_per_adv_sync *sync,
+static void confirm_recv_cb(scanner_t *scanner,
                             const struct bt_le_per_adv_sync_recv_info *info,
                             struct net_buf_simple *buf) {
     int err;
-    subevent_data_t subevent_data;
-
-    register_data_t reg_data[sel_info.num_reg_slots];
-    ack_data_t ack_data[NUM_RSP_SLOTS] = {0};
-
-    subevent_data._register_data_count = 0;
-    subevent_data._ack_data_count = NUM_RSP_SLOTS;
-    subevent_data.register_data = reg_data;
-    subevent_data.ack_data = ack_data;
+    subevent_view_t view;
 
     response_data_t resp;
-    resp.rsp_metadata = rsp_data_i;
+    resp.rsp_metadata = scanner->rsp_data_i;
     resp.data_len = 0;
+    // Responding in a register slot, the advertiser needs the sender id
+    resp.sender_in_slot = false;
 
     if (buf && buf->len) {
-        err = verify_message(buf, ADVERTISER_KEY_ID, &counter.value);
+        err = verify_advertiser_subevent(scanner, buf, info->subevent);
         if (err != 0) {
             LOG_WRN(INFO "Failed to verify message");
-            atomic_set(&fault_reason, EVT_INVALID_HASH);
-            k_sem_give(&synced_evt_sem);
+            atomic_set(&scanner->fault_reason, EVT_INVALID_HASH);
+            k_sem_give(&scanner->synced_evt_sem);
             return;
         }
 
-        resp.counter = counter.value;
-
-        LOG_INF("Test %lld", counter.value);
-        err = subevent_data_with_reg_deserialize(&subevent_data, buf);
+        LOG_INF("Test %lld", scanner->counter.value);
+        err = subevent_view_init(&view, buf, 0);
         if (err) {
             LOG_WRN(INFO "Failed to deserialize message");
         }
 
-        if (err != 0 || subevent_data.ack_data[selected_slot.rsp_slot].ack_id !=
-                            CONFIG_SCANNER_ID) {
-            err = set_rsp_data(sync, info, &resp);
+        if (err != 0 ||
+            subevent_view_ack(&view, scanner->selected_slot.rsp_slot) !=
+                scanner->id) {
+            err = set_rsp_data(scanner, info, &resp);
+            if (err == -EAGAIN) {
+                // Counter past its lease, the thread commits and comes back
+                scanner->recv = NULL;
+                atomic_set(&scanner->fault_reason, EVT_COUNTER_COMMIT);
+                k_sem_give(&scanner->synced_evt_sem);
+                return;
+            }
             if (err) {
                 LOG_WRN(INFO "Failed to send response (err %d)", err);
             }
-            if (unconfirmed_ticks != 0)
+            if (scanner->unconfirmed_ticks != 0)
                 LOG_WRN("Failed to confirm reservation");
-            unconfirmed_ticks += 1;
+            scanner->unconfirmed_ticks += 1;
 
-            if (unconfirmed_ticks >= CONFIG_MAX_UNCONFIRMED_TICKS) {
-                atomic_set(&fault_reason, EVT_CONFIRMATION_FAILED);
-                k_sem_give(&synced_evt_sem);
+            if (scanner->unconfirmed_ticks >= CONFIG_MAX_UNCONFIRMED_TICKS) {
+                atomic_set(&scanner->fault_reason, EVT_CONFIRMATION_FAILED);
+                k_sem_give(&scanner->synced_evt_sem);
                 return;
             }
             return;
         }
 
-        atomic_set(&fault_reason, EVT_NO_FAULT);
-        k_sem_give(&synced_evt_sem);
+        atomic_set(&scanner->fault_reason, EVT_NO_FAULT);
+        k_sem_give(&scanner->synced_evt_sem);
 
     } else if (buf) {
         LOG_WRN(INFO "Received empty indication: subevent %d", info->subevent);
@@ -366,7 +464,8 @@ static void confirm_recv_cb(struct bt_le_per_adv_sync *sync,
 }
 
 static bool parse_adv_data(struct bt_data *data, void *user_data) {
-    ARG_UNUSED(user_data);
+    adv_parse_t *parse = user_data;
+    scanner_t *scanner = parse->scanner;
     transfer_error_t err;
 
     NET_BUF_SIMPLE_DEFINE(adv_data_buf, data->data_len);
@@ -376,27 +475,33 @@ static bool parse_adv_data(struct bt_data *data, void *user_data) {
         return true;
 
     net_buf_simple_add_mem(&adv_data_buf, data->data, data->data_len);
-    err = verify_message(&adv_data_buf, ADVERTISER_KEY_ID, &counter.value);
+    err = verify_message(&adv_data_buf, ADVERTISER_KEY_ID,
+                         &scanner->adv_window);
     if (err != 0) {
         LOG_WRN("Couldn't verify signature on adv (err: %d)", err);
-        *(int *)user_data = err;
+        parse->err = err;
         return false;
     }
+    raise_counter(scanner, scanner->adv_window.newest);
     advertisement_data_deserialize(&adv_data, &adv_data_buf);
 
-    sel_info = adv_data.selection_info;
-    selected_slot.rsp_slot = sys_rand8_get() % sel_info.num_reg_slots;
+    scanner->sel_info = adv_data.selection_info;
+    scanner->selected_slot.rsp_slot =
+        sys_rand8_get() % scanner->sel_info.num_reg_slots;
 
-    selected_slot = adv_data.reg_data[selected_slot.rsp_slot];
+    scanner->selected_slot =
+        adv_data.reg_data[scanner->selected_slot.rsp_slot];
     return false;
 }
 
 static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
                          struct net_buf_simple *buf) {
-    char addr_str[BT_ADDR_LE_STR_LEN];
-    struct bt_le_per_adv_sync_param sync_create_param;
-    struct bt_le_per_adv_sync *sync;
-    int err = 0;
+    struct net_buf_simple_state state;
+    sys_slist_t retry;
+    sys_snode_t *node;
+    k_spinlock_key_t key;
+    bool done;
+    int err;
 
     if (!info || !info->addr) {
         return;
@@ -411,9 +516,51 @@ static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
         // Extended ADV without SyncInfo - keep scanning
         return;
     }
-    bt_data_parse(buf, &parse_adv_data, &err);
-    if (err)
+
+    // Every waiting scanner syncs to the same report, each verifies it
+    // against its own window
+    sys_slist_init(&retry);
+    net_buf_simple_save(buf, &state);
+    for (;;) {
+        key = k_spin_lock(&scan_queue_lock);
+        node = sys_slist_get(&scan_queue);
+        k_spin_unlock(&scan_queue_lock, key);
+        if (!node)
+            break;
+
+        if (scan_sync_create(CONTAINER_OF(node, scanner_t, scan_node), info,
+                             buf) != 0)
+            sys_slist_append(&retry, node);
+        net_buf_simple_restore(buf, &state);
+    }
+
+    key = k_spin_lock(&scan_queue_lock);
+    sys_slist_merge_slist(&scan_queue, &retry);
+    done = sys_slist_is_empty(&scan_queue);
+    k_spin_unlock(&scan_queue_lock, key);
+    if (!done)
+        return;
+
+    err = bt_le_scan_stop();
+    if (err) {
+        LOG_ERR(INFO "Couldn't stop le scanning");
         return;
+    }
+    LOG_INF(INFO "Stopped le scanning");
+}
+
+static int scan_sync_create(scanner_t *scanner,
+                            const struct bt_le_scan_recv_info *info,
+                            struct net_buf_simple *buf) {
+    char addr_str[BT_ADDR_LE_STR_LEN];
+    struct bt_le_per_adv_sync_param sync_create_param;
+    struct bt_le_per_adv_sync *sync;
+    adv_parse_t parse = {.scanner = scanner};
+    int err;
+
+    bt_data_parse(buf, &parse_adv_data, &parse);
+    if (parse.err)
+        return parse.err;
 
     bt_addr_le_to_str(info->addr, addr_str, sizeof(addr_str));
 
@@ -424,77 +571,90 @@ static void scan_recv_cb(const struct bt_le_scan_recv_info *info,
     sync_create_param.timeout =
         SCALE_INTERVAL_TO_TIMEOUT(info->interval) * CONFIG_NUM_FAILED_SYNC;
     LOG_INF(INFO "Establisehd sync interval %d", info->interval);
-    sync_interval = info->interval;
+    scanner->sync_interval = info->interval;
 
     err = bt_le_per_adv_sync_create(&sync_create_param, &sync);
 
     if (err) {
         LOG_WRN(INFO "Failed to create sync to %s (err %d)", addr_str, err);
-        return;
+        return err;
     }
 
-    default_sync = sync;
+    sync_owner_set(sync, scanner);
+    scanner->sync = sync;
 
     LOG_INF(INFO "Creating sync to %s (SID=%u)...", addr_str, info->sid);
-    err = bt_le_scan_stop();
-    if (err) {
-        LOG_ERR(INFO "Couldn't stop le scanning");
-        return;
-    }
-    LOG_INF(INFO "Stopped le scanning");
-    k_sem_give(&synced_sem);
+    k_sem_give(&scanner->synced_sem);
+    return 0;
 }
 
-static void ack_recv_cb(struct bt_le_per_adv_sync *sync,
-                        const struct bt_le_per_adv_sync_recv_info *info,
-                        struct net_buf_simple *buf) {
+static int scan_join(scanner_t *scanner) {
+    k_spinlock_key_t key;
+    bool first;
     int err;
-    LOG_INF("Current counter %lld", counter.value);
 
-    register_data_t reg_data[sel_info.num_reg_slots];
-    ack_data_t ack_data[NUM_RSP_SLOTS];
+    key = k_spin_lock(&scan_queue_lock);
+    first = sys_slist_is_empty(&scan_queue);
+    sys_slist_find_and_remove(&scan_queue, &scanner->scan_node);
+    sys_slist_append(&scan_queue, &scanner->scan_node);
+    k_spin_unlock(&scan_queue_lock, key);
+
+    if (!first)
+        return 0;
+
+    err = bt_le_scan_start(&scan_param, NULL);
+    return err == -EALREADY ? 0 : err;
+}
 
-    subevent_data_t subevent_data;
+static void ack_recv_cb(scanner_t *scanner,
+                        const struct bt_le_per_adv_sync_recv_info *info,
+                        struct net_buf_simple *buf) {
+    int err;
+    LOG_INF("Current counter %lld", scanner->counter.value);
 
-    subevent_data._register_data_count = 0;
-    subevent_data._ack_data_count = NUM_RSP_SLOTS;
-    subevent_data.register_data = reg_data;
-    subevent_data.ack_data = ack_data;
+    subevent_view_t view;
 
     if (buf && buf->len) {
-        err = verify_message(buf, ADVERTISER_KEY_ID, &counter.value);
+        err = verify_advertiser_subevent(scanner, buf, info->subevent);
         if (err != 0) {
             LOG_WRN("Failed to verify hash");
-            atomic_set(&fault_reason, EVT_INVALID_HASH);
-            k_sem_give(&synced_evt_sem);
+            atomic_set(&scanner->fault_reason, EVT_INVALID_HASH);
+            k_sem_give(&scanner->synced_evt_sem);
             return;
         }
 
-        err = subevent_data_with_reg_deserialize(&subevent_data, buf);
+        err = subevent_view_init(&view, buf, 0);
 
-        if (err != 0 || subevent_data.ack_data[selected_slot.rsp_slot].ack_id !=
-                            CONFIG_SCANNER_ID) {
-            if (unconfirmed_ticks != 0)
+        if (err != 0 ||
+            subevent_view_ack(&view, scanner->selected_slot.rsp_slot) !=
+                scanner->id) {
+            if (scanner->unconfirmed_ticks != 0)
                 LOG_WRN("Didn't receive ack (err: %d", err);
-            unconfirmed_ticks += 1;
+            // Queued last event, but too late for the slot or lost
+            if (atomic_clear(&scanner->rsp_awaiting_ack))
+                atomic_inc(&scanner->rsp_missed);
+            scanner->unconfirmed_ticks += 1;
         } else {
-            sync_callbacks.recv = NULL;
-            atomic_set(&fault_reason, EVT_GOT_ACK);
-            k_sem_give(&synced_evt_sem);
+            atomic_clear(&scanner->rsp_awaiting_ack);
+            scanner->recv = NULL;
+            atomic_set(&scanner->fault_reason, EVT_GOT_ACK);
+            k_sem_give(&scanner->synced_evt_sem);
             return;
         }
 
-        if (unconfirmed_ticks >= CONFIG_MAX_UNCONFIRMED_TICKS) {
-            atomic_set(&fault_reason, EVT_DIDNT_RECEIVE_ACK);
-            k_sem_give(&synced_evt_sem);
+        if (scanner->unconfirmed_ticks >= CONFIG_MAX_UNCONFIRMED_TICKS) {
+            atomic_set(&scanner->fault_reason, EVT_DIDNT_RECEIVE_ACK);
+            k_sem_give(&scanner->synced_evt_sem);
             return;
         }
 
-        response.counter = counter.value;
-        err = set_rsp_data(sync, info, &response);
-        if (err) {
+        err = send_staged_rsp_data(scanner, info);
+        if (err && err != -EAGAIN) {
             LOG_WRN(INFO "Failed to send response (err %d)", err);
         }
+        // The thread signs the next one while the slot is an event away
+        atomic_set(&scanner->fault_reason, EVT_STAGE_RSP);
+        k_sem_give(&scanner->synced_evt_sem);
     } else if (buf) {
         LOG_WRN(INFO "Received empty indication: subevent %d", info->subevent);
     } else {
@@ -503,117 +663,241 @@ static void ack_recv_cb(struct bt_le_per_adv_sync *sync,
     }
 }
 
-static int set_rsp_data(struct bt_le_per_adv_sync *sync,
+static transfer_error_t verify_advertiser_subevent(scanner_t *scanner,
+                                                   struct net_buf_simple *buf,
+                                                   uint8_t subevent) {
+    transfer_error_t err;
+
+    err = verify_subevent_message(buf, subevent, ADVERTISER_KEY_ID,
+                                  &scanner->adv_window);
+    if (err == TRANSFER_NO_ERROR)
+        raise_counter(scanner, scanner->adv_window.newest);
+    return err;
+}
+
+static int set_rsp_data(scanner_t *scanner,
                         const struct bt_le_per_adv_sync_recv_info *info,
                         response_data_t *resp) {
-    static struct bt_le_per_adv_response_params rsp_params;
+    int ret;
+
+    // Whatever was staged gets overwritten
+    atomic_clear(&scanner->rsp_staged);
+    if (!sign_rsp_data(scanner, resp))
+        return -EAGAIN;
+    ret = submit_rsp_data(scanner, info);
+    consume_counter(scanner);
+    return ret;
+}
 
-    rsp_params.request_event = info->periodic_event_counter;
-    rsp_params.request_subevent = info->subevent;
-    /* Respond in current subevent and assigned response slot */
-    rsp_params.response_subevent = info->subevent;
-    rsp_params.response_slot = selected_slot.rsp_slot;
+static int send_staged_rsp_data(scanner_t *scanner,
+                                const struct bt_le_per_adv_sync_recv_info *info) {
+    int ret;
+
+    // Skips this event rather than signing here, the slot is too close
+    if (!atomic_cas(&scanner->rsp_staged, true, false) ||
+        // After a long gap the advertiser moved on too far for the staged
+        // counter
+        scanner->counter.value - scanner->staged_counter >
+            CONFIG_CRYPTO_COUNTER_LEASE) {
+        atomic_inc(&scanner->rsp_not_staged);
+        return -EAGAIN;
+    }
 
-    net_buf_simple_reset(&message_rsp_buf);
-    response_data_serialize(resp, &message_rsp_buf);
-    sign_message(&message_rsp_buf, MIN_SCANNER_KEY_ID);
+    atomic_inc(&scanner->rsp_presigned);
+    ret = submit_rsp_data(scanner, info);
+    if (ret == 0)
+        atomic_set(&scanner->rsp_awaiting_ack, true);
+    return ret;
+}
+
+static void stage_rsp_data(scanner_t *scanner) {
+    // Registration went through, the slot is ours
+    scanner->response.sender_in_slot = true;
+    if (!sign_rsp_data(scanner, &scanner->response))
+        return;
+    scanner->staged_counter = scanner->response.counter;
+    consume_counter(scanner);
+    atomic_set(&scanner->rsp_staged, true);
+}
+
+static bool sign_rsp_data(scanner_t *scanner, response_data_t *resp) {
+    if (scanner->counter.value >= scanner->counter.reserved)
+        return false;
+    resp->counter = scanner->counter.value;
+
+    net_buf_simple_reset(&scanner->message_rsp_buf);
+    response_data_serialize(resp, &scanner->message_rsp_buf);
+    sign_message_with_header(&scanner->message_rsp_buf,
+                             response_header_len(&scanner->message_rsp_buf),
+                             scanner->key_id);
+    return true;
+}
+
+static int submit_rsp_data(scanner_t *scanner,
+                           const struct bt_le_per_adv_sync_recv_info *info) {
+    struct bt_le_per_adv_response_params *rsp_params = &scanner->rsp_params;
+    int ret;
+
+    rsp_params->request_event = info->periodic_event_counter;
+    rsp_params->request_subevent = info->subevent;
+    /* Respond in current subevent and assigned response slot */
+    rsp_params->response_subevent = info->subevent;
+    rsp_params->response_slot = scanner->selected_slot.rsp_slot;
 
     LOG_INF(INFO "Indication: subevent %d, responding in slot %d, len: %d",
-            info->subevent, selected_slot.rsp_slot, message_rsp_buf.len);
+            info->subevent, scanner->selected_slot.rsp_slot,
+            scanner->message_rsp_buf.len);
 
-    int ret =
-        bt_le_per_adv_set_response_data(sync, &rsp_params, &message_rsp_buf);
-    counter.value++;
+    ret = bt_le_per_adv_set_response_data(scanner->sync, rsp_params,
+                                          &scanner->message_rsp_buf);
+    if (ret)
+        atomic_inc(&scanner->rsp_submit_failed);
     return ret;
 }
 
-static state_t init() {
+static void consume_counter(scanner_t *scanner) {
+    // Runs from confirm_recv_cb too, the journal write is left to the thread
+    if (crypto_secure_counter_advance(&scanner->counter))
+        atomic_set(&scanner->counter_commit_pending, true);
+}
+
+static void raise_counter(scanner_t *scanner, uint64_t newest) {
+    // Runs from the receive callbacks, which may have to sign right after
+    scanner->counter.value = MAX(scanner->counter.value, newest);
+    if (crypto_secure_counter_sync(&scanner->counter))
+        atomic_set(&scanner->counter_commit_pending, true);
+}
+
+static void commit_pending_counter(scanner_t *scanner) {
+    if (atomic_get(&scanner->counter_commit_pending))
+        commit_counter(scanner);
+}
+
+static void commit_counter(scanner_t *scanner) {
+    psa_status_t psa_err = crypto_secure_counter_commit(&scanner->counter);
+
+    if (psa_err != PSA_SUCCESS) {
+        LOG_WRN(INFO "Failed to commit counter (err %d)", psa_err);
+        return;
+    }
+    // The new lease covers any raise so far
+    atomic_clear(&scanner->counter_commit_pending);
+}
+
+static int scanner_bt_enable() {
+    int err = 0;
+
+    k_mutex_lock(&bt_enable_mutex, K_FOREVER);
+    if (!bt_enabled) {
+        err = bt_enable(NULL);
+        if (!err) {
+            bt_le_scan_cb_register(&scan_callbacks);
+            bt_le_per_adv_sync_cb_register(&sync_callbacks);
+            bt_enabled = true;
+        }
+    }
+    k_mutex_unlock(&bt_enable_mutex);
+    return err;
+}
+
+static state_t init(scanner_t *scanner) {
     int err;
     psa_status_t psa_err;
     k_sleep(K_SECONDS(5));
 #ifdef CONFIG_INTERACTIVE
     init_led(led);
 #endif
-    LOG_INF("Device id: %d", CONFIG_SCANNER_ID);
+    LOG_INF("Device id: %d", scanner->id);
 
     if (crypto_init() != PSA_SUCCESS) {
         LOG_WRN("FAILED TO INIT PSA");
         return FAULT_HANDLING;
     }
 
-    if ((psa_err = crypto_secure_counter_init(&counter)) != PSA_SUCCESS) {
+#if defined(CONFIG_CRYPTO_SIM_KEYS)
+    // Simulated devices derive their keys instead of having them flashed
+    psa_err = crypto_sim_key_import(ADVERTISER_KEY_ID, 0);
+    if (psa_err == PSA_SUCCESS)
+        psa_err = crypto_sim_key_import(scanner->key_id, scanner->id);
+    if (psa_err != PSA_SUCCESS) {
+        LOG_WRN("FAILED TO IMPORT SIMULATION KEYS (err: %d)", psa_err);
+        return FAULT_HANDLING;
+    }
+#endif // CONFIG_CRYPTO_SIM_KEYS
+
+    if ((psa_err = crypto_secure_counter_init(&scanner->counter)) !=
+        PSA_SUCCESS) {
         LOG_WRN("FAILED TO INIT SECURE COUNTER (err: %d)", psa_err);
         return FAULT_HANDLING;
     }
 
+    replay_window_init(&scanner->adv_window, scanner->counter.value);
     LOG_INF(INFO "Device with id %d initialised with counter %lld",
-            CONFIG_SCANNER_ID, counter.value);
+            scanner->id, scanner->counter.value);
 
-    selected_slot.subevent = 0;
+    scanner->selected_slot.subevent = 0;
 
-    err = bt_enable(NULL);
+    err = scanner_bt_enable();
     if (err) {
         LOG_ERR(INFO "Bluetooth init failed (err %d)", err);
-        atomic_set(&fault_reason, EVT_BLE_ENABLE_FAILED);
+        atomic_set(&scanner->fault_reason, EVT_BLE_ENABLE_FAILED);
         return FAULT_HANDLING;
     }
 
-    bt_le_scan_cb_register(&scan_callbacks);
     return SYNCING;
 }
 
-static state_t syncing() {
+static state_t syncing(scanner_t *scanner) {
     int err;
-    // sync_callbacks.recv = &register_recv_cb;
+    // scanner->recv = &register_recv_cb;
 
-    if (default_sync) {
-        bt_le_per_adv_sync_delete(default_sync);
-        default_sync = NULL;
-    }
+    sync_delete(scanner);
 
-    bt_le_per_adv_sync_cb_register(&sync_callbacks);
-    err = bt_le_scan_start(&scan_param, NULL);
+    err = scan_join(scanner);
 
     if (err) {
         LOG_ERR(INFO "Failed to start scanning for sync %d", err);
-        atomic_set(&fault_reason, EVT_BLE_SCAN_START_FAILED);
+        atomic_set(&scanner->fault_reason, EVT_BLE_SCAN_START_FAILED);
         return FAULT_HANDLING;
     }
 
     for (size_t sync_iters = 0;; sync_iters++) {
-        if (k_sem_take(&synced_sem, K_SECONDS(10))) {
+        if (k_sem_take(&scanner->synced_sem, K_SECONDS(10))) {
             LOG_INF(INFO "Still syncing, iterations %d", sync_iters);
+            // Scanning may have stopped for other scanners just as this one
+            // joined
+            bt_le_scan_start(&scan_param, NULL);
             continue;
         }
         break;
     }
-    k_sem_reset(&synced_sem);
+    k_sem_reset(&scanner->synced_sem);
     return CONFIRMING;
 }
 
-static state_t handle_fault() {
-    LOG_ERR(INFO "Handling fault %ld", atomic_get(&fault_reason));
+static state_t handle_fault(scanner_t *scanner) {
+    LOG_ERR(INFO "Handling fault %ld", atomic_get(&scanner->fault_reason));
     // Wait for a while so that buffer get's flushed
     k_sleep(K_SECONDS(10));
     sys_reboot(SYS_REBOOT_COLD);
 }
 
-static state_t registering() {
+static state_t registering(scanner_t *scanner) {
     struct bt_le_per_adv_sync_param sync_create_param;
     struct bt_le_per_adv_sync_info info;
     struct bt_le_per_adv_sync *sync;
     int err;
 
-    sync_callbacks.recv = &register_recv_cb;
-    k_sem_take(&register_evt_sem, K_FOREVER);
-    k_sem_reset(&register_evt_sem);
-    if (atomic_get(&fault_reason) == EVT_INVALID_HASH) {
-        sync_callbacks.recv = NULL;
-        bt_le_per_adv_sync_delete(default_sync);
+    scanner->recv = &register_recv_cb;
+    k_sem_take(&scanner->register_evt_sem, K_FOREVER);
+    k_sem_reset(&scanner->register_evt_sem);
+    if (atomic_get(&scanner->fault_reason) == EVT_INVALID_HASH) {
+        scanner->recv = NULL;
+        sync_delete(scanner);
         return SYNCING;
     }
 
-    bt_le_per_adv_sync_get_info(default_sync, &info);
+    bt_le_per_adv_sync_get_info(scanner->sync, &info);
 
     bt_addr_le_copy(&sync_create_param.addr, &info.addr);
     sync_create_param.options = 0;
@@ -623,9 +907,9 @@ static state_t registering() {
         SCALE_INTERVAL_TO_TIMEOUT(info.interval) * CONFIG_NUM_FAILED_SYNC;
 
     LOG_INF(INFO "Establisehd sync interval %d", info.interval);
-    sync_interval = info.interval;
+    scanner->sync_interval = info.interval;
 
-    bt_le_per_adv_sync_delete(default_sync);
+    sync_delete(scanner);
     err = bt_le_per_adv_sync_create(&sync_create_param, &sync);
 
     if (err) {
@@ -634,52 +918,64 @@ static state_t registering() {
         return FAULT_HANDLING;
     }
 
-    default_sync = sync;
+    sync_owner_set(sync, scanner);
+    scanner->sync = sync;
 
-    k_sem_take(&synced_evt_sem, K_FOREVER);
-    evt_t curr = atomic_get(&fault_reason);
+    k_sem_take(&scanner->synced_evt_sem, K_FOREVER);
+    evt_t curr = atomic_get(&scanner->fault_reason);
     if (curr != EVT_BLE_SYNC_DELETED)
         return FAULT_HANDLING;
     return CONFIRMING;
 }
 
-static state_t confirming() {
-    unconfirmed_ticks = 0;
-    k_sleep(K_MSEC(sync_interval * 1.25));
-    sync_callbacks.recv = &confirm_recv_cb;
-
-    k_sem_take(&synced_evt_sem, K_FOREVER);
-    k_sem_reset(&synced_evt_sem);
-    evt_t reason = atomic_get(&fault_reason);
+static state_t confirming(scanner_t *scanner) {
+    // Joining raised the counter to the advertiser's, confirm_recv_cb only
+    // flags commits
+    commit_pending_counter(scanner);
+    scanner->unconfirmed_ticks = 0;
+    k_sleep(K_MSEC(scanner->sync_interval * 1.25));
+    scanner->recv = &confirm_recv_cb;
+
+    k_sem_take(&scanner->synced_evt_sem, K_FOREVER);
+    k_sem_reset(&scanner->synced_evt_sem);
+    evt_t reason = atomic_get(&scanner->fault_reason);
     switch (reason) {
     case EVT_INVALID_HASH:
     case EVT_CONFIRMATION_FAILED:
     case EVT_BLE_SYNC_DELETED:
     case EVT_BLE_SYNC_TIMEOUT:
-        sync_callbacks.recv = NULL;
+        scanner->recv = NULL;
         return SYNCING;
+    case EVT_COUNTER_COMMIT:
+        return CONFIRMING;
     case EVT_NO_FAULT:
+        SIM_REPORT(scanner, "join");
         break;
     default:
         LOG_INF("Got unexcepted event %d", reason);
         return FAULT_HANDLING;
     }
-    data_generator_init(&generator_config);
+    data_generator_init(&scanner->generator_config);
     return SLEEPING;
 }
 
-static state_t sleeping() {
-    bt_le_per_adv_sync_recv_disable(default_sync);
+static state_t sleeping(scanner_t *scanner) {
+    bt_le_per_adv_sync_recv_disable(scanner->sync);
     state_t ret = FAULT_HANDLING;
 
     for (;;) {
-        if (k_sem_take(&synced_evt_sem, K_SECONDS(30))) {
-            LOG_INF(INFO "Still alive");
+        if (k_sem_take(&scanner->synced_evt_sem, K_SECONDS(30))) {
+            LOG_INF(INFO "Still alive, responses presigned: %ld, not "
+                         "staged: %ld, submit failed: %ld, missed: %ld",
+                    atomic_get(&scanner->rsp_presigned),
+                    atomic_get(&scanner->rsp_not_staged),
+                    atomic_get(&scanner->rsp_submit_failed),
+                    atomic_get(&scanner->rsp_missed));
             continue;
         }
-        evt_t curr = atomic_get(&fault_reason);
+        evt_t curr = atomic_get(&scanner->fault_reason);
 
-        k_sem_init(&synced_evt_sem, 0, 1);
+        k_sem_init(&scanner->synced_evt_sem, 0, 1);
         switch (curr) {
         case EVT_NO_FAULT:
             continue;
@@ -688,6 +984,11 @@ static state_t sleeping() {
             ret = SYNCING;
             goto ret_generator_stop;
         case EVT_DATA_GENERATED:
+            SIM_REPORT(scanner, "data,%u", scanner->data_seq);
+            // Receiving is off, sign now so ack_recv_cb only has to send
+            commit_pending_counter(scanner);
+            stage_rsp_data(scanner);
+            scanner->unconfirmed_ticks = 0;
             ret = ENABLED;
             goto ret_default;
         default:
@@ -695,42 +996,57 @@ static state_t sleeping() {
         }
     }
 ret_generator_stop:
-    data_generator_stop();
+    data_generator_stop(&scanner->generator_config);
 ret_default:
-    sync_callbacks.recv = NULL;
+    scanner->recv = NULL;
     return ret;
 }
 
-static state_t enabled() {
+static state_t enabled(scanner_t *scanner) {
     state_t ret;
-    sync_callbacks.recv = &ack_recv_cb;
-    unconfirmed_ticks = 0;
-    bt_le_per_adv_sync_recv_enable(default_sync);
-    k_sem_take(&synced_evt_sem, K_FOREVER);
-    k_sem_reset(&synced_evt_sem);
-
-    int reason = atomic_get(&fault_reason);
+    // Entered again after every staged response, unconfirmed_ticks keeps
+    // counting until new data comes in
+    scanner->recv = &ack_recv_cb;
+    bt_le_per_adv_sync_recv_enable(scanner->sync);
+    k_sem_take(&scanner->synced_evt_sem, K_FOREVER);
+    k_sem_reset(&scanner->synced_evt_sem);
+
+    int reason = atomic_get(&scanner->fault_reason);
     switch (reason) {
     case EVT_GOT_ACK:
-        LOG_INF(STATS "%d, %d, %d", unconfirmed_ticks, true,
-                rsp_data_i.counter);
+        SIM_REPORT(scanner, "ack,%u", scanner->data_seq);
+        LOG_INF(STATS "%d, %d, %d", scanner->unconfirmed_ticks, true,
+                scanner->data_seq);
         LOG_INF(INFO "Got ACK");
-        bt_le_per_adv_sync_recv_disable(default_sync);
+        bt_le_per_adv_sync_recv_disable(scanner->sync);
         ret = SLEEPING;
         goto ret_default;
     case EVT_DIDNT_RECEIVE_ACK:
-        LOG_INF(STATS "%d, %d, %d", unconfirmed_ticks, false,
-                rsp_data_i.counter);
+        LOG_INF(STATS "%d, %d, %d", scanner->unconfirmed_ticks, false,
+                scanner->data_seq);
         LOG_INF(INFO "Failed to receive ACK in %d events, reregistering",
-                unconfirmed_ticks);
+                scanner->unconfirmed_ticks);
     case EVT_INVALID_HASH:
     case EVT_BLE_SYNC_TIMEOUT:
-        LOG_INF(STATS "%d, %d, %d", unconfirmed_ticks, false,
-                rsp_data_i.counter);
+        LOG_INF(STATS "%d, %d, %d", scanner->unconfirmed_ticks, false,
+                scanner->data_seq);
         ret = SYNCING;
         goto ret_generator_stop;
     case EVT_DATA_GENERATED:
-        LOG_INF(STATS "%d, %d, -1", unconfirmed_ticks, false);
+        SIM_REPORT(scanner, "data,%u", scanner->data_seq);
+        LOG_INF(STATS "%d, %d, -1", scanner->unconfirmed_ticks, false);
+        // The staged response still carries the old data
+        bt_le_per_adv_sync_recv_disable(scanner->sync);
+        commit_pending_counter(scanner);
+        stage_rsp_data(scanner);
+        scanner->unconfirmed_ticks = 0;
+        ret = ENABLED;
+        goto ret_default;
+    case EVT_STAGE_RSP:
+        // The staged response went out, or couldn't be staged in time
+        bt_le_per_adv_sync_recv_disable(scanner->sync);
+        commit_pending_counter(scanner);
+        stage_rsp_data(scanner);
         ret = ENABLED;
         goto ret_default;
     default:
@@ -738,23 +1054,27 @@ static state_t enabled() {
         goto ret_generator_stop;
     }
 ret_generator_stop:
-    data_generator_stop();
+    data_generator_stop(&scanner->generator_config);
 ret_default:
     return ret;
 }
 
-static void data_generated_cb() {
-    rsp_data_i.counter++;
-    response.rsp_metadata = rsp_data_i;
-    response.data = random.data;
-    response.data_len = UNUSED_DATA_LEN;
+static void data_generated_cb(data_generator_config_t *config) {
+    scanner_t *scanner = CONTAINER_OF(config, scanner_t, generator_config);
+
+    scanner->data_seq++;
+    scanner->response.rsp_metadata = scanner->rsp_data_i;
+    scanner->response.data = scanner->random.data;
+    scanner->response.data_len = UNUSED_DATA_LEN;
 
-    atomic_set(&fault_reason, EVT_DATA_GENERATED);
-    k_sem_give(&synced_evt_sem);
+    atomic_set(&scanner->fault_reason, EVT_DATA_GENERATED);
+    k_sem_give(&scanner->synced_evt_sem);
     return;
 }
 
-static state_t run_state() { return states[curr_state](); }
+static state_t run_state(scanner_t *scanner) {
+    return states[scanner->curr_state](scanner);
+}
 
 static char *state_str(state_t s) {
     switch (s) {
@@ -777,9 +1097,50 @@ static char *state_str(state_t s) {
     }
 }
 
-void loop() {
+void scanner_init(scanner_t *scanner, uint16_t id, psa_key_id_t key_id,
+                  psa_storage_uid_t counter_uid) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->id = id;
+    scanner->key_id = key_id;
+    scanner->curr_state = INITIALIZE;
+    atomic_set(&scanner->fault_reason, EVT_NO_FAULT);
+
+    k_sem_init(&scanner->synced_evt_sem, 0, 1);
+    k_sem_init(&scanner->register_evt_sem, 0, 1);
+    k_sem_init(&scanner->synced_sem, 0, 1);
+
+    net_buf_simple_init_with_data(&scanner->message_rsp_buf,
+                                  scanner->message_rsp_data,
+                                  sizeof(scanner->message_rsp_data));
+    net_buf_simple_reset(&scanner->message_rsp_buf);
+    net_buf_simple_init_with_data(&scanner->random, scanner->random_data,
+                                  sizeof(scanner->random_data));
+    net_buf_simple_reset(&scanner->random);
+
+    scanner->rsp_data_i.sender_id = id;
+    scanner->generator_config.data = &scanner->random;
+    scanner->generator_config.interval = CONFIG_BLOCK_TIME;
+    scanner->generator_config.generated = &data_generated_cb;
+    scanner->counter.storage_uid = counter_uid;
+}
+
+void scanner_run(scanner_t *scanner) {
     for (;;) {
-        LOG_INF(FSM "Transitioning to state %s", state_str(curr_state));
-        curr_state = run_state();
+        LOG_INF(FSM "Scanner %d transitioning to state %s", scanner->id,
+                state_str(scanner->curr_state));
+        scanner->curr_state = run_state(scanner);
     }
 }
+
+void loop() {
+    static scanner_t scanner;
+    uint16_t id = CONFIG_SCANNER_ID;
+
+#if defined(CONFIG_SCANNER_SIM)
+    // Device 0 is the advertiser, every other device is the scanner with its
+    // number as id
+    id = bsim_args_get_global_device_nbr();
+#endif
+    scanner_init(&scanner, id, MIN_SCANNER_KEY_ID, COUNTER_ID);
+    scanner_run(&scanner);
+}
@@ -29,7 +29,155 @@
 #include <app/lib/interactive.h>
 #endif
 
+#ifdef CONFIG_SCANNER_SIM
+#include <bsim_args_runner.h>
+#endif
+
+/**
+ * Enum for states of this fsm.
+ */
+typedef enum {
+    INITIALIZE,
+    FAULT_HANDLING,
+    SYNCING,
+    REGISTERING,
+    CONFIRMING,
+    SLEEPING,
+    ENABLED,
+    NUM_STATES
+} state_t;
+
+/**
+ * Enum for faults/events that can happen during fsm cycle.
+ */
+typedef enum {
+    EVT_NO_FAULT,
+    EVT_BLE_ENABLE_FAILED,
+    EVT_BLE_SCAN_START_FAILED,
+    EVT_BLE_SYNC_TIMEOUT,
+    EVT_BLE_SYNC_DELETED,
+    EVT_CONFIRMATION_FAILED,
+    EVT_DIDNT_RECEIVE_ACK,
+    EVT_DATA_GENERATED,
+    EVT_GOT_ACK,
+    EVT_INVALID_HASH,
+    EVT_COUNTER_COMMIT,
+    EVT_STAGE_RSP
+} evt_t;
+
+typedef struct scanner scanner_t;
+
+/**
+ * \brief Handles subevent data received by scanner, changes with the state.
+ */
+typedef void scanner_recv_t(scanner_t *scanner,
+                            const struct bt_le_per_adv_sync_recv_info *info,
+                            struct net_buf_simple *buf);
+
+/**
+ * \brief Everything one scanner keeps between events.
+ * Bluetooth callbacks find their scanner through the sync object, so one image
+ * can run many scanners, each on its own thread in \ref scanner_run.
+ */
+struct scanner {
+    uint16_t id;
+    /** Key responses are signed with */
+    psa_key_id_t key_id;
+
+    /** Current state of fsm. */
+    state_t curr_state;
+    /** Reason why state exited */
+    atomic_t fault_reason;
+    /** Handler of received subevents, NULL while not receiving */
+    scanner_recv_t *recv;
+
+    /** Information about how to select subevent */
+    subevent_sel_info_t sel_info;
+    register_data_t selected_slot;
+
+    /** Current ble sync object. */
+    struct bt_le_per_adv_sync *sync;
+    uint16_t sync_interval;
+    /** Waiting for a scan report to create a sync from */
+    sys_snode_t scan_node;
+
+    struct k_sem synced_evt_sem;
+    struct k_sem register_evt_sem;
+    struct k_sem synced_sem;
+
+    /** Netbuf for responses from message */
+    struct net_buf_simple message_rsp_buf;
+    uint8_t message_rsp_data[SUBEVENT_DATA_MAX_LEN];
+    struct net_buf_simple random;
+    uint8_t random_data[UNUSED_DATA_LEN];
+    response_data_t response;
+    struct bt_le_per_adv_response_params rsp_params;
+
+    /**
+     * \brief Set while message_rsp_buf holds a signed response to
+     * \ref response which wasn't sent yet, signed with staged_counter.
+     */
+    atomic_t rsp_staged;
+    uint64_t staged_counter;
+
+    /**
+     * Number of responses sent presigned, events without a response because
+     * the scanner thread hadn't staged one yet, responses the host refused to
+     * queue, and responses which were queued but not acked in the next event.
+     * The controller doesn't report a response that came too late for its
+     * slot, those show up as missed.
+     */
+    atomic_t rsp_presigned;
+    atomic_t rsp_not_staged;
+    atomic_t rsp_submit_failed;
+    atomic_t rsp_missed;
+    /** Set while a queued response waits for its ack */
+    atomic_t rsp_awaiting_ack;
+
+    /** Data which we send to advertiser. */
+    rsp_data_t rsp_data_i;
+    /** Number of data generated, only reported and not sent */
+    uint32_t data_seq;
+
+    /**
+     * \brief Number of consecutive uncofirmed responses in confirming state.
+     * If this number reaches CONFIG_MAX_UNCONFIRMED_TICKS, the device will try
+     * to register again.
+     */
+    uint8_t unconfirmed_ticks;
+
+    data_generator_config_t generator_config;
+
+    crypto_counter_t counter;
+    /**
+     * Set when signing or raising the counter to the advertiser's ran its
+     * lease low. The scanner thread commits it, responses aren't signed with
+     * a counter past counter.reserved meanwhile.
+     */
+    atomic_t counter_commit_pending;
+    /**
+     * Counters accepted from the advertiser. Starts at the persisted counter,
+     * so nothing from before a reset is accepted again.
+     */
+    replay_window_t adv_window;
+};
+
+/**
+ * \brief Sets up scanner as device id, signing with key_id and keeping its
+ * counter at counter_uid. Nothing is sent until \ref scanner_run.
+ */
+void scanner_init(scanner_t *scanner, uint16_t id, psa_key_id_t key_id,
+                  psa_storage_uid_t counter_uid);
+
+/**
+ * \brief Runs the fsm of scanner, doesn't return.
+ */
+void scanner_run(scanner_t *scanner);
 
+/**
+ * \brief Runs the scanner of this image, with CONFIG_SCANNER_SIM the one of
+ * the simulated device.
+ */
 void loop();
 
 #endif // SCANNER_FSM_H
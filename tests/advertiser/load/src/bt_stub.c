@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <string.h>
+
+#include "bt_stub.h"
+
+struct bt_le_ext_adv {
+    bool per_adv_started;
+    bool ext_adv_started;
+};
+
+bt_stub_t bt_stub;
+
+static struct bt_le_ext_adv adv_set;
+K_SEM_DEFINE(started_sem, 0, 1);
+
+int bt_stub_wait_started(k_timeout_t timeout) {
+    return k_sem_take(&started_sem, timeout);
+}
+
+struct bt_le_ext_adv *bt_stub_adv(void) { return &adv_set; }
+
+static void check_started(void) {
+    if (adv_set.per_adv_started && adv_set.ext_adv_started)
+        k_sem_give(&started_sem);
+}
+
+int bt_enable(bt_ready_cb_t cb) {
+    if (cb)
+        cb(0);
+    return 0;
+}
+
+int bt_le_ext_adv_create(const struct bt_le_adv_param *param,
+                         const struct bt_le_ext_adv_cb *cb,
+                         struct bt_le_ext_adv **adv) {
+    ARG_UNUSED(param);
+    bt_stub.cb = cb;
+    *adv = &adv_set;
+    return 0;
+}
+
+int bt_le_per_adv_set_param(struct bt_le_ext_adv *adv,
+                            const struct bt_le_per_adv_param *param) {
+    ARG_UNUSED(adv);
+    if (param->num_subevents > MAX_NUM_SUBEVENTS ||
+        param->num_response_slots > NUM_RSP_SLOTS)
+        return -EINVAL;
+    bt_stub.params = *param;
+    return 0;
+}
+
+int bt_le_ext_adv_set_data(struct bt_le_ext_adv *adv, const struct bt_data *ad,
+                           size_t ad_len, const struct bt_data *sd,
+                           size_t sd_len) {
+    ARG_UNUSED(adv);
+    ARG_UNUSED(sd);
+    ARG_UNUSED(sd_len);
+
+    for (size_t i = 0; i < ad_len; i++) {
+        if (ad[i].type != BT_DATA_MANUFACTURER_DATA)
+            continue;
+        memcpy(bt_stub.adv_data, ad[i].data, ad[i].data_len);
+        bt_stub.adv_data_len = ad[i].data_len;
+        bt_stub.adv_data_updates++;
+    }
+    return 0;
+}
+
+int bt_le_per_adv_set_subevent_data(
+    const struct bt_le_ext_adv *adv, uint8_t num_subevents,
+    const struct bt_le_per_adv_subevent_data_params *params) {
+    ARG_UNUSED(adv);
+
+    for (size_t i = 0; i < num_subevents; i++) {
+        const struct bt_le_per_adv_subevent_data_params *p = &params[i];
+
+        if (p->subevent >= bt_stub.params.num_subevents ||
+            p->data->len > SUBEVENT_DATA_MAX_LEN) {
+            bt_stub.subevent_errors++;
+            return -EINVAL;
+        }
+        memcpy(bt_stub.subevent_data[p->subevent], p->data->data, p->data->len);
+        bt_stub.subevent_len[p->subevent] = p->data->len;
+        atomic_set_bit(bt_stub.subevents_set, p->subevent);
+    }
+    return 0;
+}
+
+int bt_le_per_adv_start(struct bt_le_ext_adv *adv) {
+    adv->per_adv_started = true;
+    check_started();
+    return 0;
+}
+
+int bt_le_ext_adv_start(struct bt_le_ext_adv *adv,
+                        const struct bt_le_ext_adv_start_param *param) {
+    ARG_UNUSED(param);
+    adv->ext_adv_started = true;
+    check_started();
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef BT_STUB_H
+#define BT_STUB_H
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+
+#include <app/lib/transfer.h>
+
+#include "slot_allocator.h"
+
+/**
+ * \brief What the advertiser handed to the controller.
+ * Filled in by the stand-ins for the bt_le_ext_adv and bt_le_per_adv calls in
+ * bt_stub.c, read by the test in place of the scanners' radios. Everything is
+ * copied, as the controller copies it into HCI commands.
+ */
+typedef struct {
+    const struct bt_le_ext_adv_cb *cb;
+    struct bt_le_per_adv_param params;
+    /** Manufacturer data of the last adv data update */
+    uint8_t adv_data[UINT8_MAX];
+    uint8_t adv_data_len;
+    uint32_t adv_data_updates;
+    /** Subevent data, valid while the subevent's bit in subevents_set is set */
+    uint8_t subevent_data[MAX_NUM_SUBEVENTS][SUBEVENT_DATA_MAX_LEN];
+    uint8_t subevent_len[MAX_NUM_SUBEVENTS];
+    ATOMIC_DEFINE(subevents_set, MAX_NUM_SUBEVENTS);
+    /** Subevent data the controller would have refused */
+    uint32_t subevent_errors;
+} bt_stub_t;
+
+extern bt_stub_t bt_stub;
+
+/**
+ * \brief Waits until the advertiser started periodic and extended advertising.
+ *
+ * \return 0 once started, -EAGAIN on timeout
+ */
+int bt_stub_wait_started(k_timeout_t timeout);
+
+/**
+ * \return Advertising set passed to the advertiser's callbacks
+ */
+struct bt_le_ext_adv *bt_stub_adv(void);
+
+#endif // BT_STUB_H
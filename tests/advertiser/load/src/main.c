@@ -0,0 +1,656 @@
+/*
+ * @file advertiser load test
+ *
+ * Runs advertiser_fsm.c against the controller stand-in in bt_stub.c and
+ * plays the controller and every scanner. Each periodic event the test asks
+ * for all subevents the way the controller does, reads the acks out of them
+ * and answers with a signed response in every slot a scanner holds. Scanners
+ * register through the register slots in the adv data until every slot is
+ * taken, then some drop out and others take their place while forged
+ * responses are mixed in.
+ *
+ * Both callbacks are timed on the host clock and checked against the time
+ * the controller leaves them, one line per callback is printed prefixed with
+ * "LOAD,":
+ *
+ * LOAD,callback,calls,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,deadline_ns,misses
+ *
+ * With CONFIG_ADV_CAPTURE the capture of both phases is printed at the end,
+ * ready for tests/advertiser/replay.
+ * With CONFIG_ADV_LATENCY the stage histograms of the advertiser are checked
+ * to have counted every callback.
+ */
+
+#include <native_rtc.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include <app/lib/common.h>
+#include <app/lib/transfer.h>
+
+#include "advertiser_fsm.h"
+#include "bt_stub.h"
+#include "slot_allocator.h"
+
+/** Scanners competing for the slots, the spare ones replace drop outs */
+#define NUM_SCANNERS (SLOT_COUNT + 256)
+/** Ids above the scanners' are only sent in forged responses */
+#define FORGED_ID_MIN (NUM_SCANNERS + 1)
+BUILD_ASSERT(FORGED_ID_MIN <= CONFIG_MAX_SCANNER_ID,
+             "No scanner ids left for forged responses");
+
+/**
+ * Slots a scanner can confirm its registration in. Slots past ACK_MAX_IDS in
+ * a full subevent are never acked, so with a long tag some stay in flux.
+ */
+#define ACKABLE_SLOTS (MAX_NUM_SUBEVENTS * MIN(NUM_RSP_SLOTS, ACK_MAX_IDS))
+
+#define FILL_MAX_EVENTS 200
+#define LOAD_EVENTS 60
+/** Responding scanners out of 1000 that drop out in an event */
+#define DROP_PERMILLE 2
+/** Events a dropped scanner stays silent, long enough to get expired */
+#define DROP_EVENTS 12
+/**
+ * Events in a row a scanner goes without an ack before it gives up on its
+ * slot and registers again
+ */
+#define CONFIRM_EVENTS 3
+
+#define ADVERTISER_STACK_SIZE 4096
+#define ADVERTISER_PRIORITY K_PRIO_PREEMPT(0)
+
+/**
+ * Latency histogram buckets grow by an eighth of a power of two, so a
+ * percentile is at most 12.5% above the exact value.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+    const char *name;
+    uint32_t buckets[HIST_BUCKETS];
+    uint32_t count;
+    uint64_t max_ns;
+    uint64_t deadline_ns;
+    uint32_t misses;
+} latency_hist_t;
+
+typedef enum {
+    SCANNER_IDLE,
+    SCANNER_REGISTERING,
+    SCANNER_ACTIVE,
+    SCANNER_DROPPED,
+} scanner_state_t;
+
+/**
+ * \brief Scanner id - 1 is the index into scanners.
+ */
+typedef struct {
+    scanner_state_t state;
+    register_data_t slot;
+    uint64_t counter;
+    /** Events left to get acked, or to stay dropped */
+    uint16_t events_left;
+    /** Responded in its slot, the next subevent has to ack it */
+    bool awaiting_ack;
+} sim_scanner_t;
+
+/**
+ * \brief Response of an earlier event, sent again in the same slot.
+ */
+typedef struct {
+    uint8_t data[SUBEVENT_DATA_MAX_LEN];
+    uint8_t len;
+    uint8_t rsp_slot;
+} replay_t;
+
+typedef struct {
+    uint32_t events;
+    uint32_t registrations;
+    uint32_t drop_outs;
+    uint32_t acks;
+    uint32_t acks_missed;
+    uint32_t forged;
+    uint32_t forged_acked;
+    /** Slots freed while a forged response was handled */
+    uint32_t forged_evictions;
+    uint32_t verify_errors;
+    uint32_t subevents_missing;
+    uint16_t active;
+    uint16_t active_max;
+} load_stats_t;
+
+static sim_scanner_t scanners[NUM_SCANNERS];
+/** Id of the scanner responding in each slot, 0 if none */
+static uint16_t slot_owner[MAX_NUM_SUBEVENTS][NUM_RSP_SLOTS];
+static replay_t replays[MAX_NUM_SUBEVENTS];
+/** Each subevent is verified as if a different scanner was synced to it */
+static replay_window_t subevent_windows[MAX_NUM_SUBEVENTS];
+static uint64_t adv_counter;
+static uint16_t idle_cursor;
+static uint32_t rand_state = 1;
+
+static load_stats_t stats;
+static latency_hist_t request_hist = {.name = "request_cb"};
+static latency_hist_t response_hist = {.name = "response_cb"};
+static latency_hist_t forged_hist = {.name = "response_cb_forged"};
+/** Callbacks run over all phases, each one is a record in the capture */
+static uint32_t callbacks;
+
+static uint8_t rsp_payload[UNUSED_DATA_LEN];
+NET_BUF_SIMPLE_DEFINE_STATIC(rsp_buf, SUBEVENT_DATA_MAX_LEN);
+NET_BUF_SIMPLE_DEFINE_STATIC(subevent_buf,
+                             SUBEVENT_DATA_MAX_LEN + COUNTER_WIRE_SLACK);
+
+K_THREAD_STACK_DEFINE(advertiser_stack, ADVERTISER_STACK_SIZE);
+static struct k_thread advertiser_thread;
+
+/**
+ * \brief Host time, the simulated clock doesn't move while code runs.
+ */
+static uint64_t host_ns(void) {
+    uint32_t nsec;
+    uint64_t sec;
+
+    native_rtc_gettime(RTC_CLOCK_PSEUDOHOSTREALTIME, &nsec, &sec);
+    return sec * NSEC_PER_SEC + nsec;
+}
+
+static uint32_t rand32(void) {
+    // xorshift32, the same load every run
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static uint16_t hist_bucket(uint32_t ns) {
+    uint8_t msb;
+
+    if (ns < BIT(HIST_SUB_BITS))
+        return ns;
+    msb = 31 - __builtin_clz(ns);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+           ((ns >> (msb - HIST_SUB_BITS)) & BIT_MASK(HIST_SUB_BITS));
+}
+
+static uint64_t hist_bucket_max(uint16_t bucket) {
+    uint8_t shift = bucket >> HIST_SUB_BITS;
+    uint64_t mantissa = bucket & BIT_MASK(HIST_SUB_BITS);
+
+    if (shift == 0)
+        return mantissa;
+    return ((BIT(HIST_SUB_BITS) + mantissa + 1) << (shift - 1)) - 1;
+}
+
+static void hist_add(latency_hist_t *hist, uint64_t ns) {
+    hist->buckets[hist_bucket(MIN(ns, UINT32_MAX))]++;
+    hist->count++;
+    hist->max_ns = MAX(hist->max_ns, ns);
+    if (ns > hist->deadline_ns)
+        hist->misses++;
+}
+
+static uint64_t hist_percentile(const latency_hist_t *hist, uint32_t permille) {
+    uint64_t target = DIV_ROUND_UP((uint64_t)hist->count * permille, 1000);
+    uint64_t seen = 0;
+
+    for (uint16_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= MAX(target, 1))
+            return MIN(hist_bucket_max(i), hist->max_ns);
+    }
+    return hist->max_ns;
+}
+
+static void hist_reset(latency_hist_t *hist, uint64_t deadline_ns) {
+    memset(hist->buckets, 0, sizeof(hist->buckets));
+    hist->count = 0;
+    hist->max_ns = 0;
+    hist->misses = 0;
+    hist->deadline_ns = deadline_ns;
+}
+
+static void hist_print(const latency_hist_t *hist) {
+    printk("LOAD,%s,%u,%llu,%llu,%llu,%llu,%llu,%llu,%u\n", hist->name,
+           hist->count, (unsigned long long)hist_percentile(hist, 500),
+           (unsigned long long)hist_percentile(hist, 900),
+           (unsigned long long)hist_percentile(hist, 990),
+           (unsigned long long)hist_percentile(hist, 999),
+           (unsigned long long)hist->max_ns,
+           (unsigned long long)hist->deadline_ns, hist->misses);
+}
+
+/**
+ * \brief Time from one subevent to the next, the controller asks for a
+ * subevent's data at the latest one subevent ahead.
+ */
+static uint64_t subevent_interval_ns(void) {
+    return bt_stub.params.subevent_interval * 1250ULL * NSEC_PER_USEC;
+}
+
+/**
+ * \brief Time between two response slots, response_cb has to be done with
+ * one response before the next one arrives.
+ */
+static uint64_t response_slot_ns(void) {
+    return bt_stub.params.response_slot_spacing * 125ULL * NSEC_PER_USEC;
+}
+
+static void stats_reset(void) {
+    uint16_t active = stats.active;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.active = stats.active_max = active;
+    hist_reset(&request_hist, subevent_interval_ns());
+    hist_reset(&response_hist, response_slot_ns());
+    hist_reset(&forged_hist, response_slot_ns());
+}
+
+static sim_scanner_t *scanner_get(uint16_t id) { return &scanners[id - 1]; }
+
+static uint16_t scanner_id(const sim_scanner_t *scanner) {
+    return scanner - scanners + 1;
+}
+
+static void scanner_leave_slot(sim_scanner_t *scanner,
+                               scanner_state_t state) {
+    slot_owner[scanner->slot.subevent][scanner->slot.rsp_slot] = 0;
+    scanner->state = state;
+    scanner->awaiting_ack = false;
+}
+
+/**
+ * \brief Sends the next idle scanner to register in slot.
+ */
+static void offer_register_slot(register_data_t slot) {
+    sim_scanner_t *scanner;
+
+    if (slot.subevent >= bt_stub.params.num_subevents ||
+        slot.rsp_slot >= NUM_RSP_SLOTS ||
+        slot_owner[slot.subevent][slot.rsp_slot] != 0)
+        return;
+
+    for (uint16_t i = 0; i < NUM_SCANNERS; i++) {
+        scanner = &scanners[(idle_cursor + i) % NUM_SCANNERS];
+        if (scanner->state != SCANNER_IDLE)
+            continue;
+
+        idle_cursor = (idle_cursor + i + 1) % NUM_SCANNERS;
+        scanner->state = SCANNER_REGISTERING;
+        scanner->slot = slot;
+        scanner->events_left = CONFIRM_EVENTS;
+        scanner->awaiting_ack = false;
+        slot_owner[slot.subevent][slot.rsp_slot] = scanner_id(scanner);
+        return;
+    }
+}
+
+/**
+ * \brief Takes the counter and the register slots from the adv data, as a
+ * scanner does. The MAC isn't checked, the stub only holds what the
+ * advertiser signed.
+ */
+static void read_adv_data(void) {
+    const uint8_t *data = bt_stub.adv_data;
+    size_t trailer = sizeof(uint8_t) + sizeof(uint64_t) + HASH_LEN;
+    uint8_t num_reg_slots;
+
+    zassert_true(bt_stub.adv_data_len > trailer, "adv data too short");
+    num_reg_slots = data[bt_stub.adv_data_len - trailer];
+    adv_counter = sys_get_le64(&data[bt_stub.adv_data_len - trailer + 1]);
+    zassert_equal(bt_stub.adv_data_len,
+                  num_reg_slots * sizeof(register_data_t) + trailer);
+
+    for (uint8_t i = 0; i < num_reg_slots; i++) {
+        offer_register_slot((register_data_t){
+            .subevent = data[2 * i], .rsp_slot = data[2 * i + 1]});
+    }
+}
+
+static void drop_scanners(void) {
+    for (uint16_t i = 0; i < NUM_SCANNERS; i++) {
+        sim_scanner_t *scanner = &scanners[i];
+
+        if (scanner->state == SCANNER_DROPPED) {
+            // Back with a lost slot, has to register again
+            if (--scanner->events_left == 0)
+                scanner->state = SCANNER_IDLE;
+            continue;
+        }
+        if (scanner->state != SCANNER_ACTIVE ||
+            rand32() % 1000 >= DROP_PERMILLE)
+            continue;
+
+        scanner_leave_slot(scanner, SCANNER_DROPPED);
+        scanner->events_left = DROP_EVENTS;
+        stats.drop_outs++;
+        stats.active--;
+    }
+}
+
+/**
+ * \brief Verifies the subevent the advertiser sent and checks the ack of every
+ * scanner which responded in it the last time.
+ *
+ * \return true if the subevent was sent and verified
+ */
+static bool receive_subevent(uint8_t subevent) {
+    subevent_view_t view;
+    subevent_view_iter_t iter = {0};
+    uint8_t rsp_slot;
+    uint16_t ack_id;
+    bool received = false;
+
+    if (atomic_test_bit(bt_stub.subevents_set, subevent)) {
+        net_buf_simple_reset(&subevent_buf);
+        net_buf_simple_add_mem(&subevent_buf, bt_stub.subevent_data[subevent],
+                               bt_stub.subevent_len[subevent]);
+        received = verify_subevent_message(&subevent_buf, subevent,
+                                           ADVERTISER_KEY_ID,
+                                           &subevent_windows[subevent]) ==
+                       TRANSFER_NO_ERROR &&
+                   subevent_view_init(&view, &subevent_buf, 0) ==
+                       TRANSFER_NO_ERROR;
+        if (!received)
+            stats.verify_errors++;
+    } else if (!IS_ENABLED(CONFIG_ADV_SLOT_COMPACTION) || subevent == 0) {
+        stats.subevents_missing++;
+    }
+
+    while (received && subevent_view_next_ack(&view, &iter, &rsp_slot, &ack_id)) {
+        if (ack_id >= FORGED_ID_MIN)
+            stats.forged_acked++;
+    }
+
+    for (uint8_t i = 0; i < NUM_RSP_SLOTS; i++) {
+        uint16_t id = slot_owner[subevent][i];
+        sim_scanner_t *scanner;
+
+        if (id == 0)
+            continue;
+        scanner = scanner_get(id);
+        if (!scanner->awaiting_ack)
+            continue;
+        scanner->awaiting_ack = false;
+
+        if (received && subevent_view_ack(&view, i) == id) {
+            stats.acks++;
+            scanner->events_left = CONFIRM_EVENTS;
+            if (scanner->state == SCANNER_REGISTERING) {
+                scanner->state = SCANNER_ACTIVE;
+                stats.registrations++;
+                stats.active++;
+                stats.active_max = MAX(stats.active_max, stats.active);
+            }
+            continue;
+        }
+
+        stats.acks_missed++;
+        if (--scanner->events_left > 0)
+            continue;
+        if (scanner->state == SCANNER_ACTIVE)
+            stats.active--;
+        scanner_leave_slot(scanner, SCANNER_IDLE);
+    }
+    return received;
+}
+
+static void deliver(uint8_t subevent, uint8_t rsp_slot,
+                    struct net_buf_simple *buf, latency_hist_t *hist) {
+    struct bt_le_per_adv_response_info info = {
+        .subevent = subevent,
+        .response_slot = rsp_slot,
+        .rssi = -60,
+    };
+    uint64_t start;
+
+    start = host_ns();
+    bt_stub.cb->pawr_response(bt_stub_adv(), &info, buf);
+    hist_add(hist, host_ns() - start);
+    callbacks++;
+}
+
+/**
+ * \brief Signs the next response of scanner into rsp_buf, as the scanner
+ * builds it while registering or once it got its slot.
+ */
+static void sign_response(sim_scanner_t *scanner) {
+    bool registering = scanner->state == SCANNER_REGISTERING;
+    uint16_t id = scanner_id(scanner);
+    response_data_t response = {
+        .rsp_metadata = {.sender_id = id},
+        .data = rsp_payload,
+        .data_len = registering ? 0 : sizeof(rsp_payload),
+        .sender_in_slot = !registering,
+    };
+
+    scanner->counter = MAX(scanner->counter, adv_counter) + 1;
+    response.counter = scanner->counter;
+
+    net_buf_simple_reset(&rsp_buf);
+    response_data_serialize(&response, &rsp_buf);
+    zassert_ok(sign_message_with_header(&rsp_buf, response_header_len(&rsp_buf),
+                                        MIN_SCANNER_KEY_ID + id - 1));
+}
+
+/**
+ * \brief Responses nobody signed: a truncated one, one in a free slot from
+ * an unknown id, one in a held slot in the name of its owner and a response
+ * of the last event sent again.
+ */
+static void send_forged(uint8_t subevent) {
+    replay_t *replay = &replays[subevent];
+    response_data_t response = {
+        .rsp_metadata = {.sender_id = FORGED_ID_MIN +
+                                      rand32() % (CONFIG_MAX_SCANNER_ID -
+                                                  FORGED_ID_MIN + 1)},
+        .data = rsp_payload,
+        .data_len = sizeof(rsp_payload),
+        .counter = adv_counter + 1,
+    };
+    uint8_t rsp_slot = rand32() % NUM_RSP_SLOTS;
+
+    net_buf_simple_reset(&rsp_buf);
+    net_buf_simple_add_u8(&rsp_buf, rand32());
+    deliver(subevent, rsp_slot, &rsp_buf, &forged_hist);
+    stats.forged++;
+
+    for (uint8_t i = 0; i < NUM_RSP_SLOTS && slot_owner[subevent][rsp_slot];
+         i++)
+        rsp_slot = (rsp_slot + 1) % NUM_RSP_SLOTS;
+    if (slot_owner[subevent][rsp_slot] == 0) {
+        net_buf_simple_reset(&rsp_buf);
+        response_data_serialize(&response, &rsp_buf);
+        for (size_t i = 0; i < HASH_LEN; i++)
+            net_buf_simple_add_u8(&rsp_buf, rand32());
+        deliver(subevent, rsp_slot, &rsp_buf, &forged_hist);
+        stats.forged++;
+    }
+
+    rsp_slot = rand32() % NUM_RSP_SLOTS;
+    for (uint8_t i = 0; i < NUM_RSP_SLOTS && !slot_owner[subevent][rsp_slot];
+         i++)
+        rsp_slot = (rsp_slot + 1) % NUM_RSP_SLOTS;
+    if (slot_owner[subevent][rsp_slot] != 0) {
+        uint16_t used = slot_allocator_total_used();
+        sim_scanner_t *owner = scanner_get(slot_owner[subevent][rsp_slot]);
+
+        // Passes every check but the MAC
+        response.rsp_metadata.sender_id = slot_owner[subevent][rsp_slot];
+        response.sender_in_slot = true;
+        response.counter = MAX(owner->counter, adv_counter) + 1;
+        net_buf_simple_reset(&rsp_buf);
+        response_data_serialize(&response, &rsp_buf);
+        for (size_t i = 0; i < HASH_LEN; i++)
+            net_buf_simple_add_u8(&rsp_buf, rand32());
+        deliver(subevent, rsp_slot, &rsp_buf, &forged_hist);
+        stats.forged++;
+        if (slot_allocator_total_used() < used)
+            stats.forged_evictions++;
+    }
+
+    if (replay->len > 0) {
+        net_buf_simple_reset(&rsp_buf);
+        net_buf_simple_add_mem(&rsp_buf, replay->data, replay->len);
+        deliver(subevent, replay->rsp_slot, &rsp_buf, &forged_hist);
+        stats.forged++;
+    }
+}
+
+/**
+ * \brief Every scanner holding a slot in subevent responds, in slot order.
+ * With forge the first response is kept to be replayed in the next event.
+ */
+static void respond(uint8_t subevent, bool forge) {
+    replay_t *replay = &replays[subevent];
+
+    if (forge)
+        send_forged(subevent);
+    replay->len = 0;
+
+    for (uint8_t i = 0; i < NUM_RSP_SLOTS; i++) {
+        uint16_t id = slot_owner[subevent][i];
+        sim_scanner_t *scanner;
+
+        if (id == 0)
+            continue;
+        scanner = scanner_get(id);
+        sign_response(scanner);
+        if (forge && replay->len == 0) {
+            memcpy(replay->data, rsp_buf.data, rsp_buf.len);
+            replay->len = rsp_buf.len;
+            replay->rsp_slot = i;
+        }
+        deliver(subevent, i, &rsp_buf, &response_hist);
+        scanner->awaiting_ack = true;
+    }
+}
+
+/**
+ * \brief One periodic event, as the controller with
+ * CONFIG_BT_CTLR_SDC_PERIODIC_ADV_RSP_TX_BUFFER_COUNT TX buffers runs it.
+ * Between data requests the advertiser's worker gets the subevent intervals
+ * in simulated time to prepare the next subevents.
+ */
+static void run_event(bool churn) {
+    const uint8_t per_request =
+        CONFIG_BT_CTLR_SDC_PERIODIC_ADV_RSP_TX_BUFFER_COUNT;
+    uint8_t num_subevents = bt_stub.params.num_subevents;
+    struct bt_le_per_adv_data_request request;
+    uint64_t start;
+
+    read_adv_data();
+    if (churn)
+        drop_scanners();
+
+    for (uint8_t first = 0; first < num_subevents; first += per_request) {
+        request.start = first;
+        request.count = MIN(per_request, num_subevents - first);
+        for (uint8_t i = 0; i < request.count; i++)
+            atomic_clear_bit(bt_stub.subevents_set, first + i);
+
+        start = host_ns();
+        bt_stub.cb->pawr_data_request(bt_stub_adv(), &request);
+        hist_add(&request_hist, host_ns() - start);
+        callbacks++;
+
+        for (uint8_t i = 0; i < request.count; i++) {
+            if (receive_subevent(first + i))
+                respond(first + i, churn);
+        }
+        k_sleep(K_USEC(bt_stub.params.subevent_interval * 1250 *
+                       request.count));
+    }
+    stats.events++;
+}
+
+static void report(const char *phase) {
+    printk("advertiser load, %s: %u events, %u of %u slots held, most %u, "
+           "%u registrations, %u drop outs\n",
+           phase, stats.events, stats.active, SLOT_COUNT, stats.active_max,
+           stats.registrations, stats.drop_outs);
+    printk("advertiser load, %s: %u acks, %u missed, %u forged responses, "
+           "%u subevents missing, %u failed to verify\n",
+           phase, stats.acks, stats.acks_missed, stats.forged,
+           stats.subevents_missing, stats.verify_errors);
+    hist_print(&request_hist);
+    hist_print(&response_hist);
+    hist_print(&forged_hist);
+}
+
+ZTEST(advertiser_load, test_fill) {
+    while (stats.events < FILL_MAX_EVENTS && stats.active < ACKABLE_SLOTS)
+        run_event(false);
+    report("fill");
+
+    zassert_equal(stats.verify_errors, 0);
+    zassert_equal(stats.subevents_missing, 0);
+    zassert_true(stats.active >= ACKABLE_SLOTS,
+                 "only %u of %u slots held after %u events", stats.active,
+                 ACKABLE_SLOTS, stats.events);
+}
+
+ZTEST(advertiser_load, test_steady_state) {
+    if (stats.active < ACKABLE_SLOTS)
+        ztest_test_skip();
+
+    stats_reset();
+    for (uint32_t i = 0; i < LOAD_EVENTS; i++)
+        run_event(true);
+    report("steady state");
+
+    zassert_equal(stats.verify_errors, 0);
+    zassert_equal(stats.subevents_missing, 0);
+    zassert_equal(stats.forged_acked, 0, "forged response got acked");
+    zassert_equal(stats.forged_evictions, 0, "forged response freed a slot");
+    zassert_equal(bt_stub.subevent_errors, 0);
+    zassert_true(stats.drop_outs > 0);
+    zassert_true(stats.registrations > 0,
+                 "no scanner got a slot freed by a drop out");
+
+    if (IS_ENABLED(CONFIG_ADV_CAPTURE)) {
+        capture_header_t header;
+
+        capture_header(&header);
+        zassert_equal(capture_dump() + header.dropped, callbacks,
+                      "capture missed callbacks");
+    }
+
+    if (IS_ENABLED(CONFIG_ADV_LATENCY)) {
+        latency_summary_t request, response;
+
+        // The simulated cycle counter doesn't move while code runs, only the
+        // calls are checked
+        latency_summary(LATENCY_REQUEST_CB, &request);
+        latency_summary(LATENCY_RESPONSE_CB, &response);
+        zassert_equal(request.calls + response.calls, callbacks,
+                      "latency histograms missed callbacks");
+        latency_log();
+    }
+}
+
+static void advertiser_main(void *p1, void *p2, void *p3) { loop(); }
+
+static void *load_setup(void) {
+    memset(rsp_payload, 0x5a, sizeof(rsp_payload));
+
+    k_thread_create(&advertiser_thread, advertiser_stack,
+                    K_THREAD_STACK_SIZEOF(advertiser_stack), advertiser_main,
+                    NULL, NULL, NULL, ADVERTISER_PRIORITY, 0, K_NO_WAIT);
+    zassert_ok(bt_stub_wait_started(K_SECONDS(30)), "advertiser didn't start");
+
+    read_adv_data();
+    for (size_t i = 0; i < MAX_NUM_SUBEVENTS; i++)
+        replay_window_init(&subevent_windows[i], adv_counter);
+    stats_reset();
+
+    printk("LOAD,callback,calls,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+           "deadline_ns,misses\n");
+    return NULL;
+}
+
+ZTEST_SUITE(advertiser_load, NULL, load_setup, NULL, NULL, NULL);
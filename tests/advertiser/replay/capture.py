@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Turns the CAP lines an advertiser built with CONFIG_ADV_CAPTURE prints back
+into a capture file for tests/advertiser/replay.
+
+The capture is printed between a CAP,start and a CAP,end line, as hex. With
+several captures in the log, for instance one per reboot, the last complete
+one is written unless --index picks another.
+"""
+
+import argparse
+import re
+import sys
+
+CAP_LINE = re.compile(r"CAP,(start|end|[0-9a-f]+)\s*$")
+
+
+def parse(path):
+    captures = []
+    current = None
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = CAP_LINE.search(line)
+            if not m:
+                continue
+            field = m.group(1)
+            if field == "start":
+                current = bytearray()
+            elif field == "end":
+                if current is not None:
+                    captures.append(bytes(current))
+                current = None
+            elif current is not None:
+                current += bytes.fromhex(field)
+
+    return captures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--index", type=int, default=-1,
+                        help="capture to write, counting from 0")
+    parser.add_argument("log", help="advertiser console log")
+    parser.add_argument("out", help="capture file to write")
+    args = parser.parse_args()
+
+    captures = parse(args.log)
+    if not captures:
+        print("no complete capture in log", file=sys.stderr)
+        return 1
+    capture = captures[args.index]
+
+    with open(args.out, "wb") as f:
+        f.write(capture)
+    print(f"{len(captures)} captures in log, wrote {len(capture)} bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
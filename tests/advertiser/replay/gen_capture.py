@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Writes capture.bin, the capture tests/advertiser/replay replays by default.
+
+Three periodic events as the controller stand-in of tests/advertiser/load runs
+them, for the default build of the replay: HMAC-SHA256 with the full tag, no
+compact framing, 100 register slots. Responses are signed with the simulation
+keys of CONFIG_CRYPTO_SIM_KEYS, like the scanners of the load test sign them:
+
+- event 0, scanners 1 to 8 register in the first register slots, next to a
+  truncated response, a forged one and a response the controller lost
+- event 1, the eight send data from their slots, scanners 9 to 12 register in
+  the slots advertised next and the first response of event 0 is sent again
+- event 2, all twelve send data
+
+The advertiser counter of each record is the one the advertiser is expected
+to hold, so a replay may still count a few records with another counter.
+A capture taken with advertiser.load.capture replaces it through capture.py.
+"""
+
+import argparse
+import hashlib
+import hmac
+import random
+import struct
+
+CAPTURE_MAGIC = 0x52574150
+CAPTURE_VERSION = 1
+REQUEST, RESPONSE, RESPONSE_LOST = range(3)
+
+NUM_SUBEVENTS = 46
+NUM_RSP_SLOTS = 103
+NUM_REGISTER_SLOTS = 100
+HASH_LEN = 32
+# Response payload which fills a data response to 62 bytes, UNUSED_DATA_LEN
+DATA_LEN = 62 - HASH_LEN - 8 - 2 - 1
+TX_BUFFER_COUNT = 3
+
+# Periodic advertising parameters of advertiser_fsm.c in us
+PERIODIC_US = 2000 * 1250
+SUBEVENT_US = 43 * 1250
+RSP_SLOT_DELAY_US = 1 * 1250
+RSP_SLOT_US = 4 * 125
+
+START_US = 2_000_000
+FIRST_COUNTER = 0x1D2C3B4A59687700
+RSSI = -60
+
+
+def sim_key(device_id):
+    """Key crypto_sim_key_import derives for device_id."""
+    return hashlib.sha256(b"pawr-sim-key\0" +
+                          struct.pack("<H", device_id)).digest()
+
+
+def response(sender_id, counter, data=b"", tag=None):
+    """Response as the scanner signs it without compact framing."""
+    msg = struct.pack("<H", sender_id) + data + struct.pack("<BQ", len(data),
+                                                            counter)
+    if tag is None:
+        tag = hmac.new(sim_key(sender_id), msg, hashlib.sha256).digest()
+    return msg + tag[:HASH_LEN]
+
+
+class Capture:
+    def __init__(self):
+        self.records = bytearray()
+        self.counter = FIRST_COUNTER
+        self.rng = random.Random(1)
+        # Scanner id to its last counter and slot
+        self.scanners = {}
+        # Register slots in the order the advertiser hands them out
+        self.free_slots = [(s, r) for s in range(NUM_SUBEVENTS)
+                           for r in range(NUM_RSP_SLOTS)]
+        self.register_slots = self.free_slots[:NUM_REGISTER_SLOTS]
+        del self.free_slots[:NUM_REGISTER_SLOTS]
+        self.first_response = None
+
+    def add(self, timestamp, kind, subevent, slot, rssi=0, data=b""):
+        self.records += struct.pack("<IQBBBbB", timestamp & 0xFFFFFFFF,
+                                    self.counter, kind, subevent, slot, rssi,
+                                    len(data))
+        self.records += data
+
+    def respond(self, timestamp, subevent, slot, data):
+        self.add(timestamp, RESPONSE, subevent, slot, RSSI, data)
+
+    def sign(self, scanner_id, advertised, data=b""):
+        counter = max(self.scanners.get(scanner_id, (0, None))[0],
+                      advertised) + 1
+        return counter, response(scanner_id, counter, data)
+
+    def send(self, kind, scanner_id, subevent, slot, timestamp, advertised,
+             registered):
+        if kind == "lost":
+            self.add(timestamp, RESPONSE_LOST, subevent, slot, RSSI)
+            return
+        if kind == "truncated":
+            self.respond(timestamp, subevent, slot,
+                         bytes([self.rng.randrange(256)]))
+            return
+        if kind == "forged":
+            tag = bytes(self.rng.randrange(256) for _ in range(HASH_LEN))
+            self.respond(timestamp, subevent, slot,
+                         response(scanner_id, advertised + 1,
+                                  bytes([0x5A] * DATA_LEN), tag))
+            return
+        if kind == "replayed":
+            self.respond(timestamp, subevent, slot, self.first_response)
+            return
+
+        data = bytes([0x5A] * DATA_LEN) if kind == "data" else b""
+        counter, msg = self.sign(scanner_id, advertised, data)
+        if self.first_response is None:
+            self.first_response = msg
+        self.respond(timestamp, subevent, slot, msg)
+        # Accepting a response moves the advertiser counter up to it
+        self.counter = max(self.counter, counter)
+        if kind == "register":
+            registered.append((subevent, slot))
+            self.scanners[scanner_id] = (counter, (subevent, slot))
+        else:
+            self.scanners[scanner_id] = (counter, self.scanners[scanner_id][1])
+
+    def event(self, number, start):
+        # Scanners sign past the counter of the adv data, which the first
+        # subevents of the event move up to
+        self.counter += 1
+        advertised = self.counter
+        # Responses by slot, several in one slot are sent in order
+        responses = {}
+
+        def slot_time(subevent, slot):
+            return (start + subevent * SUBEVENT_US + RSP_SLOT_DELAY_US +
+                    slot * RSP_SLOT_US)
+
+        if number == 0:
+            for scanner_id in range(1, 9):
+                responses[self.register_slots[scanner_id - 1]] = \
+                    [("register", scanner_id)]
+            responses[(0, 60)] = [("forged", 4000)]
+            responses[(2, 7)] = [("lost", None)]
+            responses[(5, 11)] = [("truncated", None)]
+        else:
+            if number == 1:
+                # Sent before its owner responds, like the load test does
+                responses[(0, 0)] = [("replayed", 1)]
+                for i, scanner_id in enumerate(range(9, 13)):
+                    responses[self.register_slots[i]] = \
+                        [("register", scanner_id)]
+            for scanner_id, (_, slot) in self.scanners.items():
+                responses.setdefault(slot, []).append(("data", scanner_id))
+
+        registered = []
+        for first in range(0, NUM_SUBEVENTS, TX_BUFFER_COUNT):
+            count = min(TX_BUFFER_COUNT, NUM_SUBEVENTS - first)
+            self.add(start + first * SUBEVENT_US, REQUEST, first, count)
+
+            for subevent in range(first, first + count):
+                for slot in range(NUM_RSP_SLOTS):
+                    for kind, scanner_id in responses.get((subevent, slot),
+                                                          []):
+                        self.send(kind, scanner_id, subevent, slot,
+                                  slot_time(subevent, slot), advertised,
+                                  registered)
+
+        # Each registration moved its register slot to the lowest free slot
+        for slot in registered:
+            reg_idx = self.register_slots.index(slot)
+            self.register_slots[reg_idx] = self.free_slots.pop(0)
+        # The new register slots are advertised at a new counter
+        if registered:
+            self.counter += 1
+
+    def image(self):
+        header = struct.pack("<IBBBBBI", CAPTURE_MAGIC, CAPTURE_VERSION,
+                             NUM_SUBEVENTS, NUM_RSP_SLOTS, NUM_REGISTER_SLOTS,
+                             HASH_LEN, 0)
+        return header + bytes(self.records)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("out", nargs="?", default="capture.bin",
+                        help="capture file to write")
+    args = parser.parse_args()
+
+    capture = Capture()
+    for number in range(3):
+        capture.event(number, START_US + number * PERIODIC_US)
+
+    image = capture.image()
+    with open(args.out, "wb") as f:
+        f.write(image)
+    print(f"wrote {len(image)} bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
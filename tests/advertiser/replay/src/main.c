@@ -0,0 +1,252 @@
+/*
+ * @file advertiser replay
+ *
+ * Feeds a capture taken with CONFIG_ADV_CAPTURE back through the callbacks of
+ * advertiser_fsm.c, run against the controller stand-in of the load test. The
+ * advertiser counter is restored to the one of the first record and records
+ * are replayed in simulated time with their original spacing, so every run
+ * makes the same calls in the same order.
+ *
+ * The replayed callbacks are captured again and compared with the original.
+ * A record with a different counter is where the advertiser took another way
+ * than on the device, most often a response that doesn't verify with the
+ * simulation keys, or a capture that doesn't reach back to the registrations.
+ *
+ * Both callbacks are timed on the host clock, one line per callback is printed
+ * prefixed with "REPLAY,", max_record being the index of the slowest record:
+ *
+ * REPLAY,callback,calls,p50_ns,p90_ns,p99_ns,max_ns,max_record
+ */
+
+#include <native_rtc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <app/lib/common.h>
+#include <app/lib/crypto.h>
+
+#include "advertiser_fsm.h"
+#include "bt_stub.h"
+#include "capture.h"
+#include "slot_allocator.h"
+
+#define ADVERTISER_STACK_SIZE 4096
+#define ADVERTISER_PRIORITY K_PRIO_PREEMPT(0)
+
+static const uint8_t capture_file[] = {
+#include "capture.inc"
+};
+
+#define MAX_RECORDS (sizeof(capture_file) / sizeof(capture_record_t) + 1)
+
+typedef struct {
+    const char *name;
+    uint32_t ns[MAX_RECORDS];
+    uint32_t count;
+    uint32_t max_ns;
+    uint32_t max_record;
+} timing_t;
+
+static timing_t request_timing = {.name = "request_cb"};
+static timing_t response_timing = {.name = "response_cb"};
+
+static capture_header_t header;
+/** Replayed callbacks as the advertiser captured them again */
+static uint8_t recaptured[sizeof(capture_file) + 1];
+static uint8_t rsp_data[UINT8_MAX];
+static struct net_buf_simple rsp_buf;
+
+K_THREAD_STACK_DEFINE(advertiser_stack, ADVERTISER_STACK_SIZE);
+static struct k_thread advertiser_thread;
+
+/**
+ * \brief Host time, the simulated clock doesn't move while code runs.
+ */
+static uint64_t host_ns(void) {
+    uint32_t nsec;
+    uint64_t sec;
+
+    native_rtc_gettime(RTC_CLOCK_PSEUDOHOSTREALTIME, &nsec, &sec);
+    return sec * NSEC_PER_SEC + nsec;
+}
+
+static void timing_add(timing_t *timing, uint64_t ns, uint32_t record) {
+    ns = MIN(ns, UINT32_MAX);
+    if (ns >= timing->max_ns) {
+        timing->max_ns = ns;
+        timing->max_record = record;
+    }
+    timing->ns[timing->count++] = ns;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t timing_percentile(const timing_t *timing, uint32_t permille) {
+    uint64_t rank = DIV_ROUND_UP((uint64_t)timing->count * permille, 1000);
+
+    return timing->ns[MAX(rank, 1) - 1];
+}
+
+static void timing_print(timing_t *timing) {
+    if (timing->count == 0)
+        return;
+    qsort(timing->ns, timing->count, sizeof(timing->ns[0]), compare_ns);
+    printk("REPLAY,%s,%u,%u,%u,%u,%u,%u\n", timing->name, timing->count,
+           timing_percentile(timing, 500), timing_percentile(timing, 900),
+           timing_percentile(timing, 990), timing->max_ns, timing->max_record);
+}
+
+/**
+ * \return Record at offset of image, NULL if no complete record starts there
+ */
+static const capture_record_t *record_at(const uint8_t *image, size_t len,
+                                         size_t offset) {
+    const capture_record_t *record = (const capture_record_t *)&image[offset];
+
+    if (offset + sizeof(*record) > len ||
+        offset + sizeof(*record) + record->len > len)
+        return NULL;
+    return record;
+}
+
+static const uint8_t *record_data(const capture_record_t *record) {
+    return (const uint8_t *)(record + 1);
+}
+
+static void replay_record(const capture_record_t *record, uint32_t index) {
+    struct bt_le_per_adv_data_request request = {
+        .start = record->subevent,
+        .count = record->slot,
+    };
+    struct bt_le_per_adv_response_info info = {
+        .subevent = record->subevent,
+        .response_slot = record->slot,
+        .rssi = record->rssi,
+    };
+    struct net_buf_simple *buf = NULL;
+    uint64_t start;
+
+    switch (record->type) {
+    case CAPTURE_REQUEST:
+        start = host_ns();
+        bt_stub.cb->pawr_data_request(bt_stub_adv(), &request);
+        timing_add(&request_timing, host_ns() - start, index);
+        return;
+    case CAPTURE_RESPONSE:
+        // response_cb pulls from the buffer, it gets a copy
+        memcpy(rsp_data, record_data(record), record->len);
+        net_buf_simple_init_with_data(&rsp_buf, rsp_data, record->len);
+        buf = &rsp_buf;
+        break;
+    case CAPTURE_RESPONSE_LOST:
+        break;
+    default:
+        zassert_unreachable("record %u has unknown type %u", index,
+                            record->type);
+    }
+
+    start = host_ns();
+    bt_stub.cb->pawr_response(bt_stub_adv(), &info, buf);
+    timing_add(&response_timing, host_ns() - start, index);
+}
+
+/**
+ * \brief Journals the counter of the first record, so that the advertiser
+ * resumes from it instead of starting at a random value.
+ */
+static void counter_restore(uint64_t value) {
+    crypto_counter_t ctx = {.storage_uid = COUNTER_ID};
+
+    zassert_equal(crypto_init(), PSA_SUCCESS);
+    zassert_equal(crypto_secure_counter_init(&ctx), PSA_SUCCESS);
+    ctx.value = value - MIN(value, CONFIG_CRYPTO_COUNTER_LEASE);
+    zassert_equal(crypto_secure_counter_commit(&ctx), PSA_SUCCESS);
+}
+
+ZTEST(advertiser_replay, test_replay) {
+    const capture_record_t *record;
+    const capture_record_t *replayed;
+    size_t offset = sizeof(header);
+    size_t replayed_offset = 0;
+    size_t recaptured_len;
+    uint32_t last_timestamp = 0;
+    uint32_t records = 0;
+    uint32_t divergent = 0;
+    uint32_t first_divergent = 0;
+
+    while ((record = record_at(capture_file, sizeof(capture_file), offset))) {
+        if (records > 0)
+            k_sleep(K_USEC(record->timestamp - last_timestamp));
+        last_timestamp = record->timestamp;
+        replay_record(record, records++);
+        offset += sizeof(*record) + record->len;
+    }
+    zassert_equal(offset, sizeof(capture_file),
+                  "capture truncated after %u records", records);
+
+    recaptured_len = capture_take(recaptured, sizeof(recaptured));
+    offset = sizeof(header);
+    for (uint32_t i = 0; i < records; i++) {
+        record = record_at(capture_file, sizeof(capture_file), offset);
+        replayed = record_at(recaptured, recaptured_len, replayed_offset);
+        zassert_not_null(replayed, "record %u wasn't captured again", i);
+        zassert_true(record->type == replayed->type &&
+                         record->subevent == replayed->subevent &&
+                         record->slot == replayed->slot &&
+                         record->len == replayed->len &&
+                         memcmp(record_data(record), record_data(replayed),
+                                record->len) == 0,
+                     "record %u replayed differently", i);
+        if (record->counter != replayed->counter && divergent++ == 0)
+            first_divergent = i;
+        offset += sizeof(*record) + record->len;
+        replayed_offset += sizeof(*replayed) + replayed->len;
+    }
+
+    printk("advertiser replay: %u records, %u dropped while capturing, "
+           "%u with a different counter, first at %u\n",
+           records, header.dropped, divergent, first_divergent);
+    printk("REPLAY,callback,calls,p50_ns,p90_ns,p99_ns,max_ns,max_record\n");
+    timing_print(&request_timing);
+    timing_print(&response_timing);
+}
+
+static void advertiser_main(void *p1, void *p2, void *p3) { loop(); }
+
+static void *replay_setup(void) {
+    const capture_record_t *first;
+
+    zassert_true(sizeof(capture_file) >= sizeof(header), "capture too short");
+    memcpy(&header, capture_file, sizeof(header));
+    zassert_equal(header.magic, CAPTURE_MAGIC, "not a capture");
+    zassert_equal(header.version, CAPTURE_VERSION,
+                  "capture version %u not supported", header.version);
+    zassert_equal(header.num_subevents, MAX_NUM_SUBEVENTS,
+                  "captured with %u subevents", header.num_subevents);
+    zassert_equal(header.num_rsp_slots, NUM_RSP_SLOTS,
+                  "captured with %u response slots", header.num_rsp_slots);
+    zassert_equal(header.num_register_slots, CONFIG_NUM_REGISTER_SLOTS,
+                  "captured with CONFIG_NUM_REGISTER_SLOTS=%u",
+                  header.num_register_slots);
+    zassert_equal(header.hash_len, HASH_LEN, "captured with a %u byte tag",
+                  header.hash_len);
+
+    first = record_at(capture_file, sizeof(capture_file), sizeof(header));
+    if (first)
+        counter_restore(first->counter);
+
+    k_thread_create(&advertiser_thread, advertiser_stack,
+                    K_THREAD_STACK_SIZEOF(advertiser_stack), advertiser_main,
+                    NULL, NULL, NULL, ADVERTISER_PRIORITY, 0, K_NO_WAIT);
+    zassert_ok(bt_stub_wait_started(K_SECONDS(30)), "advertiser didn't start");
+    return NULL;
+}
+
+ZTEST_SUITE(advertiser_replay, NULL, replay_setup, NULL, NULL, NULL);
@@ -0,0 +1,156 @@
+/*
+ * @file test slot allocator
+ *
+ * Checks ordering of the advertiser slot allocator and churns it from
+ * threads and a timer ISR at the same time, the way the Bluetooth callbacks
+ * and the pipeline worker use it.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/ztest.h>
+
+#include "slot_allocator.h"
+
+#define STRESS_CYCLES 200000
+#define STRESS_PREFILL (SLOT_COUNT / 2)
+#define STRESS_STACK_SIZE 1024
+#define STRESS_PRIORITY K_PRIO_PREEMPT(5)
+
+static inline uint16_t slot_index(register_data_t slot) {
+    return slot.subevent * NUM_RSP_SLOTS + slot.rsp_slot;
+}
+
+static void before(void *fixture) {
+    ARG_UNUSED(fixture);
+    slot_allocator_init();
+}
+
+ZTEST(slot_allocator, test_lowest_first) {
+    register_data_t slot;
+
+    for (uint16_t i = 0; i < SLOT_COUNT; i++) {
+        zassert_ok(slot_allocator_alloc(&slot));
+        zassert_equal(slot_index(slot), i, "expected slot %d got %d", i,
+                      slot_index(slot));
+    }
+    zassert_equal(slot_allocator_alloc(&slot), -1, "allocated past SLOT_COUNT");
+    zassert_equal(slot_allocator_total_used(), SLOT_COUNT);
+    zassert_equal(slot_allocator_subevent_used(MAX_NUM_SUBEVENTS - 1),
+                  NUM_RSP_SLOTS);
+
+    slot_allocator_free((register_data_t){.subevent = 30, .rsp_slot = 2});
+    slot_allocator_free((register_data_t){.subevent = 7, .rsp_slot = 100});
+
+    zassert_ok(slot_allocator_alloc(&slot));
+    zassert_equal(slot.subevent, 7);
+    zassert_equal(slot.rsp_slot, 100);
+    zassert_ok(slot_allocator_alloc(&slot));
+    zassert_equal(slot.subevent, 30);
+    zassert_equal(slot.rsp_slot, 2);
+}
+
+ZTEST(slot_allocator, test_double_free) {
+    register_data_t slot;
+
+    zassert_ok(slot_allocator_alloc(&slot));
+    slot_allocator_free(slot);
+    slot_allocator_free(slot);
+
+    zassert_equal(slot_allocator_total_used(), 0);
+    zassert_equal(slot_allocator_subevent_used(0), 0);
+}
+
+/**
+ * Registrar takes slots and hands them to the expirer through msgq, the timer
+ * ISR does its own register/expire cycles in between. owned catches a slot
+ * handed out twice.
+ */
+K_MSGQ_DEFINE(expire_q, sizeof(register_data_t), 64, 4);
+K_THREAD_STACK_DEFINE(registrar_stack, STRESS_STACK_SIZE);
+K_THREAD_STACK_DEFINE(expirer_stack, STRESS_STACK_SIZE);
+static struct k_thread registrar_thread;
+static struct k_thread expirer_thread;
+
+static ATOMIC_DEFINE(owned, SLOT_COUNT);
+static atomic_t double_alloc;
+static atomic_t cycles;
+static atomic_t isr_cycles;
+
+static void take(register_data_t *slot) {
+    if (atomic_test_and_set_bit(owned, slot_index(*slot)))
+        atomic_inc(&double_alloc);
+}
+
+static void give(register_data_t slot) {
+    atomic_clear_bit(owned, slot_index(slot));
+    slot_allocator_free(slot);
+}
+
+static void registrar(void *p1, void *p2, void *p3) {
+    register_data_t slot;
+
+    for (uint32_t i = 0; i < STRESS_CYCLES;) {
+        if (slot_allocator_alloc(&slot) != 0) {
+            k_yield();
+            continue;
+        }
+        take(&slot);
+        while (k_msgq_put(&expire_q, &slot, K_NO_WAIT) != 0)
+            k_yield();
+        if (++i % 64 == 0)
+            k_usleep(10);
+    }
+}
+
+static void expirer(void *p1, void *p2, void *p3) {
+    register_data_t slot;
+
+    while (k_msgq_get(&expire_q, &slot, K_MSEC(100)) == 0) {
+        give(slot);
+        atomic_inc(&cycles);
+    }
+}
+
+static void isr_churn(struct k_timer *timer) {
+    register_data_t slot;
+
+    if (slot_allocator_alloc(&slot) != 0)
+        return;
+    take(&slot);
+    give(slot);
+    atomic_inc(&isr_cycles);
+}
+
+K_TIMER_DEFINE(churn_timer, isr_churn, NULL);
+
+ZTEST(slot_allocator, test_stress) {
+    register_data_t slot;
+
+    for (uint16_t i = 0; i < STRESS_PREFILL; i++)
+        zassert_ok(slot_allocator_alloc(&slot));
+
+    k_timer_start(&churn_timer, K_USEC(50), K_USEC(50));
+    k_thread_create(&registrar_thread, registrar_stack,
+                    K_THREAD_STACK_SIZEOF(registrar_stack), registrar, NULL,
+                    NULL, NULL, STRESS_PRIORITY, 0, K_NO_WAIT);
+    k_thread_create(&expirer_thread, expirer_stack,
+                    K_THREAD_STACK_SIZEOF(expirer_stack), expirer, NULL, NULL,
+                    NULL, STRESS_PRIORITY, 0, K_NO_WAIT);
+
+    k_thread_join(&registrar_thread, K_FOREVER);
+    k_thread_join(&expirer_thread, K_FOREVER);
+    k_timer_stop(&churn_timer);
+
+    // Simulated time doesn't move while the threads spin, so there is no
+    // throughput to report here
+    printk("slot_allocator stress: %ld cycles, %ld isr cycles\n",
+           atomic_get(&cycles), atomic_get(&isr_cycles));
+
+    zassert_equal(atomic_get(&double_alloc), 0, "slot handed out twice");
+    zassert_equal(atomic_get(&cycles), STRESS_CYCLES);
+    zassert_equal(slot_allocator_total_used(), STRESS_PREFILL,
+                  "slots leaked or lost");
+}
+
+ZTEST_SUITE(slot_allocator, NULL, NULL, before, NULL, NULL);
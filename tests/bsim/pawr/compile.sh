@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+# Builds advertiser and scanner for the nRF54L15 BabbleSim board and copies
+# them to ${BSIM_OUT_PATH}/bin. The advertiser holds a key per scanner, so it
+# has to be built for the number of scanners run.sh is going to start.
+#
+# usage: compile.sh [num_scanners]
+
+set -ue
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must point to the BabbleSim install}"
+
+NUM_SCANNERS=${1:-10}
+BOARD=${BOARD:-nrf54l15bsim/nrf54l15/cpuapp}
+HERE=$(cd "$(dirname "$0")" && pwd)
+APPS=$(cd "${HERE}/../../.." && pwd)
+OUT=${HERE}/build
+
+# Advertiser key plus one per scanner, with room for the ids in front
+KEYS=$((NUM_SCANNERS + 8))
+
+west build -p always --no-sysbuild -b "${BOARD}" -d "${OUT}/advertiser" \
+    "${APPS}/advertiser" -- \
+    -DEXTRA_CONF_FILE="${HERE}/sim.conf" \
+    -DCONFIG_MAX_SCANNER_ID=${NUM_SCANNERS} \
+    -DCONFIG_CRYPTO_SIM_KEYS_MAX=${KEYS} \
+    -DCONFIG_MBEDTLS_PSA_KEY_SLOT_COUNT=$((KEYS + 8)) \
+    -DCONFIG_MBEDTLS_HEAP_SIZE=$((16384 + KEYS * 128))
+
+west build -p always --no-sysbuild -b "${BOARD}" -d "${OUT}/scanner" \
+    "${APPS}/scanner" -- \
+    -DEXTRA_CONF_FILE="${HERE}/sim.conf" \
+    -DCONFIG_SCANNER_SIM=y
+
+mkdir -p "${BSIM_OUT_PATH}/bin"
+cp "${OUT}/advertiser/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_pawr_advertiser"
+cp "${OUT}/scanner/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_pawr_scanner"
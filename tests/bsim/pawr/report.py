@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Summarises the SIM lines scanners print when built with CONFIG_SCANNER_SIM.
+
+Each line is SIM,<scanner id>,<uptime us>,<event>[,<seq>] with event one of
+join, data or ack. Reports join time, packet delivery ratio and ack latency
+over all scanners.
+"""
+
+import argparse
+import re
+import sys
+
+SIM_LINE = re.compile(r"SIM,(\d+),(\d+),(\w+)(?:,(\d+))?")
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def parse(paths):
+    joins = {}
+    data = {}
+    acks = {}
+
+    for path in paths:
+        with open(path, errors="replace") as f:
+            for line in f:
+                m = SIM_LINE.search(line)
+                if not m:
+                    continue
+                scanner, t, event, seq = m.groups()
+                scanner, t = int(scanner), int(t)
+                if event == "join":
+                    joins.setdefault(scanner, t)
+                elif event == "data":
+                    data.setdefault(scanner, {})[int(seq)] = t
+                elif event == "ack":
+                    acks.setdefault(scanner, {}).setdefault(int(seq), t)
+
+    return joins, data, acks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--scanners", type=int, required=True,
+                        help="number of scanners that were started")
+    parser.add_argument("logs", nargs="+", help="device logs")
+    args = parser.parse_args()
+
+    joins, data, acks = parse(args.logs)
+
+    join_s = [t / 1e6 for t in joins.values()]
+    generated = delivered = 0
+    latency_ms = []
+    for scanner, sent in data.items():
+        acked = acks.get(scanner, {})
+        last = max(sent)
+        for seq, t in sent.items():
+            if seq in acked:
+                delivered += 1
+                latency_ms.append((acked[seq] - t) / 1e3)
+            elif seq == last:
+                # Still in flight when the simulation ended
+                continue
+            generated += 1
+
+    print(f"scanners joined: {len(joins)}/{args.scanners}")
+    print("join time s: p50 {:.3f} p95 {:.3f} max {:.3f}".format(
+        percentile(join_s, 50), percentile(join_s, 95),
+        max(join_s, default=float("nan"))))
+    print("pdr: {}/{} {:.4f}".format(
+        delivered, generated, delivered / generated if generated else 0))
+    print("ack latency ms: p50 {:.1f} p95 {:.1f} p99 {:.1f} max {:.1f}".format(
+        percentile(latency_ms, 50), percentile(latency_ms, 95),
+        percentile(latency_ms, 99), max(latency_ms, default=float("nan"))))
+
+    return 0 if len(joins) == args.scanners else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
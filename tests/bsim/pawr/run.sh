@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+# Runs one advertiser and num_scanners scanners on the BabbleSim 2.4 GHz
+# phy, then prints join time, packet delivery ratio and ack latency. Logs of
+# every device are kept in results/pawr_<num_scanners>.
+#
+# usage: run.sh [num_scanners] [sim_seconds]
+
+set -ue
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must point to the BabbleSim install}"
+
+NUM_SCANNERS=${1:-10}
+SIM_SECONDS=${2:-120}
+SIM_ID=pawr_${NUM_SCANNERS}
+HERE=$(cd "$(dirname "$0")" && pwd)
+LOG_DIR=${HERE}/results/${SIM_ID}
+
+rm -rf "${LOG_DIR}"
+mkdir -p "${LOG_DIR}"
+cd "${BSIM_OUT_PATH}/bin"
+
+# Device 0 is the advertiser, device n is scanner n
+./bs_pawr_advertiser -s=${SIM_ID} -d=0 -rs=0 > "${LOG_DIR}/d_0.log" 2>&1 &
+for d in $(seq 1 ${NUM_SCANNERS}); do
+    ./bs_pawr_scanner -s=${SIM_ID} -d=${d} -rs=${d} \
+        > "${LOG_DIR}/d_${d}.log" 2>&1 &
+done
+./bs_2G4_phy_v1 -s=${SIM_ID} -D=$((NUM_SCANNERS + 1)) \
+    -sim_length=$((SIM_SECONDS * 1000000)) > "${LOG_DIR}/phy.log" 2>&1 &
+
+wait
+
+python3 "${HERE}/report.py" --scanners ${NUM_SCANNERS} "${LOG_DIR}"/d_*.log
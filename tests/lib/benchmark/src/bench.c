@@ -0,0 +1,107 @@
+/*
+ * @file benchmark suite for the transfer and crypto libraries
+ *
+ * Every ztest in this suite measures one operation at the payload sizes used
+ * on air and reports it through bench_run().
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>
+#include <zephyr/ztest.h>
+
+#include <app/lib/crypto.h>
+
+#if defined(CONFIG_ARCH_POSIX)
+#include <native_rtc.h>
+#endif
+
+#include "bench.h"
+
+psa_key_id_t bench_key_id;
+
+#if defined(CONFIG_ARCH_POSIX)
+typedef uint64_t bench_stamp_t;
+
+static inline bench_stamp_t bench_now(void) {
+    return native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME);
+}
+
+static inline uint64_t bench_ns(bench_stamp_t start, bench_stamp_t end) {
+    return (end - start) * NSEC_PER_USEC;
+}
+
+// The simulation has no cycle counter, cycles_per_op is printed as n/a
+static inline uint64_t bench_cycles(bench_stamp_t start, bench_stamp_t end) {
+    return 0;
+}
+#else
+typedef timing_t bench_stamp_t;
+
+static inline bench_stamp_t bench_now(void) { return timing_counter_get(); }
+
+static inline uint64_t bench_ns(bench_stamp_t start, bench_stamp_t end) {
+    return timing_cycles_to_ns(timing_cycles_get(&start, &end));
+}
+
+static inline uint64_t bench_cycles(bench_stamp_t start, bench_stamp_t end) {
+    return timing_cycles_get(&start, &end);
+}
+#endif
+
+void bench_run(const char *name, size_t payload_len, bench_fn_t fn, void *arg) {
+    bench_stamp_t start, end;
+    uint64_t ns, cycles;
+    char cycles_per_op[21] = "n/a";
+
+    // warm up caches and lazily initialised PSA state
+    fn(arg);
+
+    start = bench_now();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+        fn(arg);
+    end = bench_now();
+
+    ns = MAX(bench_ns(start, end), 1);
+    cycles = bench_cycles(start, end);
+    if (!IS_ENABLED(CONFIG_ARCH_POSIX))
+        snprintk(cycles_per_op, sizeof(cycles_per_op), "%llu",
+                 (unsigned long long)(cycles / BENCH_ITERATIONS));
+
+    printk("BENCH,%s,%u,%u,%llu,%s,%llu\n", name, (unsigned int)payload_len,
+           BENCH_ITERATIONS, (unsigned long long)(ns / BENCH_ITERATIONS),
+           cycles_per_op,
+           (unsigned long long)(BENCH_ITERATIONS * NSEC_PER_SEC / ns));
+}
+
+static void *bench_setup(void) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    uint8_t key[KEY_LEN];
+
+    zassert_equal(crypto_init(), PSA_SUCCESS);
+    zassert_equal(psa_generate_random(key, sizeof(key)), PSA_SUCCESS);
+
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, key, sizeof(key), &bench_key_id),
+                  PSA_SUCCESS);
+
+    timing_init();
+    timing_start();
+
+    if (IS_ENABLED(CONFIG_ARCH_POSIX))
+        printk("bench: no cycle counter on %s, ns_per_op is host time\n",
+               CONFIG_BOARD);
+    printk("BENCH,name,payload_bytes,iterations,ns_per_op,cycles_per_op,"
+           "ops_per_s\n");
+    return NULL;
+}
+
+static void bench_teardown(void *fixture) {
+    ARG_UNUSED(fixture);
+    timing_stop();
+    psa_destroy_key(bench_key_id);
+}
+
+ZTEST_SUITE(bench, NULL, bench_setup, NULL, NULL, bench_teardown);
@@ -0,0 +1,33 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <psa/crypto.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_ITERATIONS 2000
+
+/**
+ * \brief Shared key for the benchmarks, imported as a volatile key of the
+ * selected authenticator in the suite setup.
+ */
+extern psa_key_id_t bench_key_id;
+
+typedef void (*bench_fn_t)(void *arg);
+
+/**
+ * \brief Runs fn BENCH_ITERATIONS times and prints one result line.
+ * Each line is CSV prefixed with "BENCH," so results can be grepped from the
+ * console and compared between builds:
+ *
+ * BENCH,name,payload_bytes,iterations,ns_per_op,cycles_per_op,ops_per_s
+ *
+ * On native_sim the simulated clock doesn't move while code runs, so host
+ * time is used and cycles_per_op is 0.
+ *
+ * \param name benchmark name, no commas
+ * \param payload_len bytes processed by one call to fn
+ */
+void bench_run(const char *name, size_t payload_len, bench_fn_t fn, void *arg);
+
+#endif // BENCH_H
@@ -0,0 +1,30 @@
+#include <zephyr/ztest.h>
+
+#include <app/lib/crypto.h>
+
+#include "bench.h"
+
+#define BENCH_COUNTER_UID 0x7e0000
+
+static crypto_counter_t bench_counter = {.storage_uid = BENCH_COUNTER_UID};
+
+static void commit(void *arg) { crypto_secure_counter_commit(arg); }
+
+static void advance(void *arg) {
+    if (crypto_secure_counter_advance(arg))
+        crypto_secure_counter_commit(arg);
+}
+
+ZTEST(bench, test_secure_counter) {
+    zassert_equal(crypto_secure_counter_init(&bench_counter), PSA_SUCCESS);
+
+    // One journal write
+    bench_run("secure_counter_commit", sizeof(uint64_t), commit,
+              &bench_counter);
+    // Amortized cost per message, one write every CONFIG_CRYPTO_COUNTER_LEASE/2
+    bench_run("secure_counter_advance", sizeof(uint64_t), advance,
+              &bench_counter);
+
+    psa_its_remove(BENCH_COUNTER_UID);
+    psa_its_remove(BENCH_COUNTER_UID + 1);
+}
@@ -0,0 +1,268 @@
+#include <zephyr/ztest.h>
+
+#include <app/lib/transfer.h>
+
+#include "bench.h"
+
+typedef struct {
+    struct net_buf_simple *buf;
+    struct net_buf_simple_state state;
+    replay_window_t window;
+    /** Signed message, AEAD authenticators decrypt it in place */
+    uint8_t message[SUBEVENT_DATA_MAX_LEN];
+} sign_ctx_t;
+
+NET_BUF_SIMPLE_DEFINE_STATIC(sign_buf, SUBEVENT_DATA_MAX_LEN);
+
+/**
+ * \brief Fills sign_buf with payload_len bytes followed by a counter, the way
+ * every serializer ends a message.
+ */
+static void prepare(sign_ctx_t *ctx, size_t payload_len) {
+    uint64_t counter = 1;
+
+    net_buf_simple_reset(&sign_buf);
+    memset(net_buf_simple_add(&sign_buf, payload_len), 0xa5, payload_len);
+    net_buf_simple_add_mem(&sign_buf, &counter, sizeof(counter));
+
+    ctx->buf = &sign_buf;
+    replay_window_init(&ctx->window, counter);
+}
+
+static void sign(void *arg) {
+    sign_ctx_t *ctx = arg;
+
+    net_buf_simple_restore(ctx->buf, &ctx->state);
+    sign_message(ctx->buf, bench_key_id);
+}
+
+static void verify(void *arg) {
+    sign_ctx_t *ctx = arg;
+
+    net_buf_simple_restore(ctx->buf, &ctx->state);
+    memcpy(ctx->buf->data, ctx->message, ctx->buf->len);
+    verify_message(ctx->buf, bench_key_id, &ctx->window);
+}
+
+static void bench_sign_verify(size_t payload_len, const char *sign_name,
+                              const char *verify_name) {
+    sign_ctx_t ctx;
+    size_t len;
+
+    prepare(&ctx, payload_len);
+    net_buf_simple_save(ctx.buf, &ctx.state);
+    len = ctx.buf->len;
+    bench_run(sign_name, len, sign, &ctx);
+
+    net_buf_simple_restore(ctx.buf, &ctx.state);
+    zassert_ok(sign_message(ctx.buf, bench_key_id));
+    net_buf_simple_save(ctx.buf, &ctx.state);
+    memcpy(ctx.message, ctx.buf->data, ctx.buf->len);
+    zassert_ok(verify_message(ctx.buf, bench_key_id, &ctx.window));
+    bench_run(verify_name, len, verify, &ctx);
+}
+
+ZTEST(bench, test_sign_verify_response) {
+    // Size of a scanner response
+    bench_sign_verify(RESPONSE_SLOT_HEADER_LEN + UNUSED_DATA_LEN + 1,
+                      "sign_message_response", "verify_message_response");
+}
+
+ZTEST(bench, test_sign_verify_subevent) {
+    // Largest subevent that fits in SUBEVENT_DATA_MAX_LEN once signed
+    bench_sign_verify(SUBEVENT_DATA_MAX_LEN - sizeof(uint64_t) - HASH_LEN,
+                      "sign_message_subevent", "verify_message_subevent");
+}
+
+// Subevents request_cb signs together when the pipeline missed
+#define MAC_BATCH_COUNT 4
+#define MAC_BATCH_KEY_ID 0x7f0020
+
+typedef struct {
+    psa_key_id_t key_id;
+    crypto_mac_job_t jobs[MAC_BATCH_COUNT];
+} mac_batch_ctx_t;
+
+static void mac_each(void *arg) {
+    mac_batch_ctx_t *ctx = arg;
+
+    for (size_t i = 0; i < MAC_BATCH_COUNT; i++)
+        crypto_compute_mac_batch(ctx->key_id, &ctx->jobs[i], 1);
+}
+
+static void mac_batch(void *arg) {
+    mac_batch_ctx_t *ctx = arg;
+
+    crypto_compute_mac_batch(ctx->key_id, ctx->jobs, MAC_BATCH_COUNT);
+}
+
+static void mac_verify_batch(void *arg) {
+    mac_batch_ctx_t *ctx = arg;
+    bool valid[MAC_BATCH_COUNT];
+
+    crypto_verify_mac_batch(ctx->key_id, ctx->jobs, MAC_BATCH_COUNT, valid);
+}
+
+ZTEST(bench, test_mac_batch) {
+    static uint8_t inputs[MAC_BATCH_COUNT][SUBEVENT_DATA_MAX_LEN - HASH_LEN];
+    static uint8_t macs[MAC_BATCH_COUNT][MAC_LEN];
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    mac_batch_ctx_t ctx;
+    uint8_t key[KEY_LEN];
+
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM))
+        ztest_test_skip();
+
+    for (size_t i = 0; i < MAC_BATCH_COUNT; i++) {
+        memset(inputs[i], i, sizeof(inputs[i]));
+        ctx.jobs[i] = (crypto_mac_job_t){
+            .input = inputs[i], .input_len = sizeof(inputs[i]), .mac = macs[i]};
+    }
+
+    // Persistent like the flashed keys, see CONFIG_CRYPTO_VOLATILE_KEY_CACHE
+    zassert_equal(psa_generate_random(key, sizeof(key)), PSA_SUCCESS);
+    psa_destroy_key(MAC_BATCH_KEY_ID);
+    psa_set_key_id(&attributes, MAC_BATCH_KEY_ID);
+    psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_PERSISTENT);
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, key, sizeof(key), &ctx.key_id),
+                  PSA_SUCCESS);
+
+    bench_run("mac_subevents_single", sizeof(inputs), mac_each, &ctx);
+    bench_run("mac_subevents_batch", sizeof(inputs), mac_batch, &ctx);
+    bench_run("mac_subevents_verify_batch", sizeof(inputs), mac_verify_batch,
+              &ctx);
+
+#if defined(CONFIG_CRYPTO_SECURE_CALL_STUB) &&                                 \
+    !defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+    uint32_t calls = crypto_secure_call_count();
+
+    // Like TF-M, a batch doesn't save secure calls
+    mac_batch(&ctx);
+    zassert_equal(crypto_secure_call_count() - calls, MAC_BATCH_COUNT,
+                  "batch not charged one secure call per MAC");
+#endif
+
+    psa_destroy_key(ctx.key_id);
+}
+
+#if defined(CONFIG_TRANSFER_BATCH_SIGNING)
+#define BATCH_PAYLOAD_LEN                                                      \
+    (SUBEVENT_DATA_MAX_LEN - sizeof(uint64_t) - BATCH_PROOF_LEN - HASH_LEN)
+
+typedef struct {
+    struct net_buf_simple *batch[BATCH_SIZE];
+    struct net_buf_simple_state state[BATCH_SIZE];
+} batch_ctx_t;
+
+static void sign_batch(void *arg) {
+    batch_ctx_t *ctx = arg;
+
+    for (size_t i = 0; i < BATCH_SIZE; i++)
+        net_buf_simple_restore(ctx->batch[i], &ctx->state[i]);
+    sign_message_batch(ctx->batch, 0, bench_key_id);
+}
+
+ZTEST(bench, test_sign_batch) {
+    static uint8_t storage[BATCH_SIZE][SUBEVENT_DATA_MAX_LEN];
+    static struct net_buf_simple bufs[BATCH_SIZE];
+    batch_ctx_t ctx;
+    replay_window_t window;
+    uint64_t counter = 1;
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        net_buf_simple_init_with_data(&bufs[i], storage[i], sizeof(storage[i]));
+        net_buf_simple_reset(&bufs[i]);
+        memset(net_buf_simple_add(&bufs[i], BATCH_PAYLOAD_LEN), i,
+               BATCH_PAYLOAD_LEN);
+        net_buf_simple_add_le64(&bufs[i], counter);
+        net_buf_simple_save(&bufs[i], &ctx.state[i]);
+        ctx.batch[i] = &bufs[i];
+    }
+
+    // One op signs a full batch of largest subevents, compare with
+    // BATCH_SIZE times sign_message_subevent
+    bench_run("sign_message_batch", BATCH_SIZE * bufs[0].len, sign_batch,
+              &ctx);
+
+    sign_batch(&ctx);
+    replay_window_init(&window, counter);
+    zassert_ok(verify_message_batch(&bufs[BATCH_SIZE - 1], BATCH_SIZE - 1,
+                                    bench_key_id, &window));
+}
+
+// Subevents of a full periodic event, MAX_NUM_SUBEVENTS of the advertiser
+#define EVENT_SUBEVENTS 46
+#define EVENT_BATCHES DIV_ROUND_UP(EVENT_SUBEVENTS, BATCH_SIZE)
+
+typedef struct {
+    struct net_buf_simple *bufs[EVENT_SUBEVENTS];
+    struct net_buf_simple_state state[EVENT_SUBEVENTS];
+} event_ctx_t;
+
+static void event_restore(event_ctx_t *ctx) {
+    for (size_t i = 0; i < EVENT_SUBEVENTS; i++)
+        net_buf_simple_restore(ctx->bufs[i], &ctx->state[i]);
+}
+
+static void sign_event_single(void *arg) {
+    event_ctx_t *ctx = arg;
+
+    event_restore(ctx);
+    sign_messages(ctx->bufs, EVENT_SUBEVENTS, bench_key_id);
+}
+
+static void sign_event_batch(void *arg) {
+    event_ctx_t *ctx = arg;
+    struct net_buf_simple *batch[BATCH_SIZE];
+
+    event_restore(ctx);
+    for (size_t first = 0; first < EVENT_SUBEVENTS; first += BATCH_SIZE) {
+        // The last batch is cut short, like the advertiser's
+        for (size_t i = 0; i < BATCH_SIZE; i++)
+            batch[i] = first + i < EVENT_SUBEVENTS ? ctx->bufs[first + i]
+                                                   : NULL;
+        sign_message_batch(batch, first, bench_key_id);
+    }
+}
+
+ZTEST(bench, test_sign_event) {
+    static uint8_t storage[EVENT_SUBEVENTS][SUBEVENT_DATA_MAX_LEN];
+    static struct net_buf_simple bufs[EVENT_SUBEVENTS];
+    static event_ctx_t ctx;
+    uint64_t counter = 1;
+
+    // Same payload both ways, batching only adds the proof on air
+    for (size_t i = 0; i < EVENT_SUBEVENTS; i++) {
+        net_buf_simple_init_with_data(&bufs[i], storage[i], sizeof(storage[i]));
+        net_buf_simple_reset(&bufs[i]);
+        memset(net_buf_simple_add(&bufs[i], BATCH_PAYLOAD_LEN), i,
+               BATCH_PAYLOAD_LEN);
+        net_buf_simple_add_le64(&bufs[i], counter);
+        net_buf_simple_save(&bufs[i], &ctx.state[i]);
+        ctx.bufs[i] = &bufs[i];
+    }
+
+    // One op signs every subevent of an event, compare ns_per_op
+    bench_run("sign_event_single", EVENT_SUBEVENTS * bufs[0].len,
+              sign_event_single, &ctx);
+    bench_run("sign_event_batch", EVENT_SUBEVENTS * bufs[0].len,
+              sign_event_batch, &ctx);
+
+#if defined(CONFIG_CRYPTO_SECURE_CALL_STUB) &&                                 \
+    !defined(CONFIG_CRYPTO_HMAC_MIDSTATE)
+    uint32_t calls = crypto_secure_call_count();
+
+    // One MAC per batch instead of per subevent, the stub only charges MACs
+    sign_event_single(&ctx);
+    zassert_equal(crypto_secure_call_count() - calls, EVENT_SUBEVENTS);
+    calls = crypto_secure_call_count();
+    sign_event_batch(&ctx);
+    zassert_equal(crypto_secure_call_count() - calls, EVENT_BATCHES,
+                  "batch not signed with one MAC");
+#endif
+}
+#endif // CONFIG_TRANSFER_BATCH_SIGNING
@@ -0,0 +1,158 @@
+#include <zephyr/ztest.h>
+
+#include <app/lib/transfer.h>
+
+#include "bench.h"
+
+#define REG_SLOTS 5
+// Acks which still fit next to REG_SLOTS register slots in one subevent
+#define SUBEVENT_ACKS (ACK_MAX_IDS - REG_SLOTS)
+
+typedef struct {
+    struct net_buf_simple *buf;
+    struct net_buf_simple_state state;
+    void *data;
+} serialize_ctx_t;
+
+static register_data_t reg[REG_SLOTS];
+static ack_set_t acks;
+static uint8_t rsp_payload[UNUSED_DATA_LEN];
+
+NET_BUF_SIMPLE_DEFINE_STATIC(bench_buf, SUBEVENT_DATA_MAX_LEN);
+
+static void fill_subevent(subevent_data_t *data) {
+    for (size_t i = 0; i < REG_SLOTS; i++)
+        reg[i] = (register_data_t){.subevent = 0, .rsp_slot = i};
+
+    ack_set_init(&acks);
+    for (size_t i = 0; i < SUBEVENT_ACKS; i++)
+        ack_set_add(&acks, REG_SLOTS + i, i + 1);
+
+    *data = (subevent_data_t){.register_data = reg,
+                              .acks = &acks,
+                              .counter = 1,
+                              ._register_data_count = REG_SLOTS};
+}
+
+static void fill_response(response_data_t *rsp) {
+    memset(rsp_payload, 0x5a, sizeof(rsp_payload));
+    *rsp = (response_data_t){.rsp_metadata = {.sender_id = 1},
+                             .data = rsp_payload,
+                             .data_len = sizeof(rsp_payload),
+                             .counter = 1};
+}
+
+static void adv_serialize(void *arg) {
+    net_buf_simple_reset(&bench_buf);
+    advertisement_data_serialize(arg, &bench_buf);
+}
+
+static void subevent_serialize(void *arg) {
+    net_buf_simple_reset(&bench_buf);
+    subevent_data_with_reg_serialize(arg, &bench_buf);
+}
+
+static void subevent_deserialize(void *arg) {
+    serialize_ctx_t *ctx = arg;
+
+    net_buf_simple_restore(ctx->buf, &ctx->state);
+    subevent_data_with_reg_deserialize(ctx->data, ctx->buf);
+}
+
+static void subevent_view_lookup(void *arg) {
+    serialize_ctx_t *ctx = arg;
+    subevent_view_t view;
+
+    if (subevent_view_init(&view, ctx->buf, REG_SLOTS) == 0)
+        *(uint16_t *)ctx->data = subevent_view_ack(&view, NUM_RSP_SLOTS - 1);
+}
+
+static void response_serialize(void *arg) {
+    net_buf_simple_reset(&bench_buf);
+    response_data_serialize(arg, &bench_buf);
+}
+
+static void response_deserialize(void *arg) {
+    serialize_ctx_t *ctx = arg;
+
+    net_buf_simple_restore(ctx->buf, &ctx->state);
+    response_data_deserialize(ctx->data, ctx->buf);
+}
+
+ZTEST(bench, test_advertisement_data_serialize) {
+    advertisement_data_t adv = {.reg_data = reg,
+                                .selection_info.num_reg_slots = REG_SLOTS,
+                                .counter = 1};
+
+    adv_serialize(&adv);
+    bench_run("advertisement_data_serialize", bench_buf.len, adv_serialize,
+              &adv);
+}
+
+ZTEST(bench, test_subevent_data_with_reg_serialize) {
+    subevent_data_t data;
+
+    fill_subevent(&data);
+    subevent_serialize(&data);
+    bench_run("subevent_data_with_reg_serialize", bench_buf.len,
+              subevent_serialize, &data);
+}
+
+ZTEST(bench, test_subevent_data_with_reg_deserialize) {
+    subevent_data_t data, out;
+    register_data_t reg_out[REG_SLOTS];
+    ack_set_t acks_out;
+    serialize_ctx_t ctx = {.buf = &bench_buf, .data = &out};
+
+    fill_subevent(&data);
+    out = (subevent_data_t){.register_data = reg_out,
+                            .acks = &acks_out,
+                            ._register_data_count = REG_SLOTS};
+    subevent_serialize(&data);
+    // verify_message strips the counter before deserialization
+    net_buf_simple_remove_mem(&bench_buf, sizeof(uint64_t));
+    net_buf_simple_save(&bench_buf, &ctx.state);
+
+    zassert_ok(subevent_data_with_reg_deserialize(&out, &bench_buf));
+    zassert_equal(acks_out.count, SUBEVENT_ACKS);
+    bench_run("subevent_data_with_reg_deserialize", ctx.state.len,
+              subevent_deserialize, &ctx);
+}
+
+ZTEST(bench, test_subevent_view_ack) {
+    subevent_data_t data;
+    uint16_t ack_id;
+    serialize_ctx_t ctx = {.buf = &bench_buf, .data = &ack_id};
+
+    fill_subevent(&data);
+    subevent_serialize(&data);
+    net_buf_simple_remove_mem(&bench_buf, sizeof(uint64_t));
+
+    // Last slot is the worst case, its rank counts the whole bitmap
+    subevent_view_lookup(&ctx);
+    zassert_equal(ack_id, ack_set_get(&acks, NUM_RSP_SLOTS - 1));
+    bench_run("subevent_view_ack", bench_buf.len, subevent_view_lookup, &ctx);
+}
+
+ZTEST(bench, test_response_data_serialize) {
+    response_data_t rsp;
+
+    fill_response(&rsp);
+    response_serialize(&rsp);
+    bench_run("response_data_serialize", bench_buf.len, response_serialize,
+              &rsp);
+}
+
+ZTEST(bench, test_response_data_deserialize) {
+    response_data_t rsp, out;
+    serialize_ctx_t ctx = {.buf = &bench_buf, .data = &out};
+
+    fill_response(&rsp);
+    response_serialize(&rsp);
+    net_buf_simple_remove_mem(&bench_buf, sizeof(uint64_t));
+    net_buf_simple_save(&bench_buf, &ctx.state);
+
+    zassert_ok(response_data_deserialize(&out, &bench_buf));
+    bench_run("response_data_deserialize", ctx.state.len, response_deserialize,
+              &ctx);
+}
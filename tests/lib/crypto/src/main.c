@@ -0,0 +1,289 @@
+/*
+ * @file test crypto library
+ *
+ * This suite checks that the journaled secure counter never resumes below a
+ * value it handed out and only writes its journal once per half lease, and
+ * that crypto_compute_mac and crypto_compute_mac_batch match psa_mac_compute
+ * and crypto_verify_mac_batch tells which tags match.
+ */
+
+#include <zephyr/ztest.h>
+
+#include <app/lib/common.h>
+#include <app/lib/crypto.h>
+
+#define TEST_COUNTER_UID 0x7f0000
+#define TEST_KEY_ID 0x7f0010
+#define TEST_BATCH_COUNT 3
+// Longest signed input of a subevent
+#define SUBEVENT_INPUT_LEN 219
+
+static void *crypto_setup(void) {
+    zassert_equal(crypto_init(), PSA_SUCCESS);
+    return NULL;
+}
+
+static void before(void *fixture) {
+    ARG_UNUSED(fixture);
+    psa_its_remove(TEST_COUNTER_UID);
+    psa_its_remove(TEST_COUNTER_UID + 1);
+}
+
+ZTEST(crypto_lib, test_counter_lease) {
+    crypto_counter_t counter = {.storage_uid = TEST_COUNTER_UID};
+    uint32_t seq;
+    size_t commits = 0;
+
+    zassert_equal(crypto_secure_counter_init(&counter), PSA_SUCCESS);
+    zassert_true(counter.value < counter.reserved);
+    seq = counter.seq;
+
+    for (size_t i = 0; i < 4 * CONFIG_CRYPTO_COUNTER_LEASE; i++) {
+        if (crypto_secure_counter_advance(&counter)) {
+            zassert_equal(crypto_secure_counter_commit(&counter), PSA_SUCCESS);
+            commits++;
+        }
+        zassert_true(counter.value < counter.reserved, "value past lease");
+    }
+
+    zassert_equal(commits, 8, "expected one journal write per half lease");
+    zassert_equal(counter.seq, seq + commits);
+}
+
+ZTEST(crypto_lib, test_counter_resume) {
+    crypto_counter_t counter = {.storage_uid = TEST_COUNTER_UID};
+    crypto_counter_t resumed = {.storage_uid = TEST_COUNTER_UID};
+
+    zassert_equal(crypto_secure_counter_init(&counter), PSA_SUCCESS);
+    for (size_t i = 0; i < CONFIG_CRYPTO_COUNTER_LEASE / 2 - 1; i++)
+        zassert_false(crypto_secure_counter_advance(&counter));
+
+    // Reset without a commit, the counter continues from the reserved bound
+    zassert_equal(crypto_secure_counter_init(&resumed), PSA_SUCCESS);
+    zassert_equal(resumed.value, counter.reserved);
+    zassert_true(resumed.reserved > resumed.value);
+}
+
+ZTEST(crypto_lib, test_counter_sync) {
+    crypto_counter_t counter = {.storage_uid = TEST_COUNTER_UID};
+
+    zassert_equal(crypto_secure_counter_init(&counter), PSA_SUCCESS);
+    zassert_false(crypto_secure_counter_sync(&counter));
+
+    // verify_message raised the value past the lease
+    counter.value = counter.reserved + 10;
+    zassert_true(crypto_secure_counter_sync(&counter));
+    zassert_equal(crypto_secure_counter_commit(&counter), PSA_SUCCESS);
+    zassert_true(counter.value < counter.reserved);
+}
+
+ZTEST(crypto_lib, test_counter_raise_resume) {
+    crypto_counter_t counter = {.storage_uid = TEST_COUNTER_UID};
+    crypto_counter_t resumed = {.storage_uid = TEST_COUNTER_UID};
+    uint64_t raised;
+
+    zassert_equal(crypto_secure_counter_init(&counter), PSA_SUCCESS);
+
+    // Raised to a peer's newest counter, then signed with before a reset
+    raised = counter.reserved + 2 * CONFIG_CRYPTO_COUNTER_LEASE;
+    counter.value = raised;
+    zassert_true(crypto_secure_counter_sync(&counter));
+    zassert_equal(crypto_secure_counter_commit(&counter), PSA_SUCCESS);
+
+    zassert_equal(crypto_secure_counter_init(&resumed), PSA_SUCCESS);
+    zassert_true(resumed.value > raised, "resumed at a used value");
+    zassert_equal(resumed.value, counter.reserved);
+}
+
+ZTEST(crypto_lib, test_compute_mac) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t key_id;
+    uint8_t key[KEY_LEN], input[SUBEVENT_INPUT_LEN], expected[MAC_LEN];
+    size_t len;
+    CRYPTO_MAC_BUF_DEFINE(mac);
+    struct net_buf_simple input_buf;
+
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM))
+        ztest_test_skip();
+
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = 0xa0 + i;
+    for (size_t i = 0; i < sizeof(input); i++)
+        input[i] = i;
+
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, key, sizeof(key), &key_id),
+                  PSA_SUCCESS);
+
+    // Every length around the SHA-256 block boundaries
+    for (size_t l = 0; l <= sizeof(input); l++) {
+        net_buf_simple_init_with_data(&input_buf, input, l);
+        net_buf_simple_reset(&mac);
+        zassert_equal(crypto_compute_mac(key_id, &input_buf, l, &mac),
+                      PSA_SUCCESS);
+        zassert_equal(psa_mac_compute(key_id, CRYPTO_ALG, input, l,
+                                      expected, sizeof(expected), &len),
+                      PSA_SUCCESS);
+        zassert_mem_equal(mac.data, expected, MAC_LEN, "length %zu", l);
+    }
+
+    psa_destroy_key(key_id);
+}
+
+ZTEST(crypto_lib, test_compute_mac_batch) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t key_id;
+    uint8_t key[KEY_LEN], input[SUBEVENT_INPUT_LEN];
+    uint8_t macs[TEST_BATCH_COUNT][MAC_LEN], expected[MAC_LEN];
+    crypto_mac_job_t jobs[TEST_BATCH_COUNT];
+    size_t len;
+
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM))
+        ztest_test_skip();
+
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = 0x50 + i;
+    for (size_t i = 0; i < sizeof(input); i++)
+        input[i] = 3 * i;
+    for (size_t i = 0; i < TEST_BATCH_COUNT; i++) {
+        jobs[i] = (crypto_mac_job_t){.input = input + i,
+                                     .input_len = sizeof(input) - 7 * i,
+                                     .mac = macs[i]};
+    }
+
+    // Persistent like the flashed keys, so the volatile key cache copies it
+    psa_destroy_key(TEST_KEY_ID);
+    psa_set_key_id(&attributes, TEST_KEY_ID);
+    psa_set_key_lifetime(&attributes, PSA_KEY_LIFETIME_PERSISTENT);
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, key, sizeof(key), &key_id),
+                  PSA_SUCCESS);
+
+    // Second round runs from whatever the first one cached
+    for (size_t round = 0; round < 2; round++) {
+        memset(macs, 0, sizeof(macs));
+        zassert_equal(crypto_compute_mac_batch(key_id, jobs, TEST_BATCH_COUNT),
+                      PSA_SUCCESS);
+        for (size_t i = 0; i < TEST_BATCH_COUNT; i++) {
+            zassert_equal(psa_mac_compute(key_id, CRYPTO_ALG, jobs[i].input,
+                                          jobs[i].input_len, expected,
+                                          sizeof(expected), &len),
+                          PSA_SUCCESS);
+            zassert_mem_equal(macs[i], expected, MAC_LEN, "job %zu", i);
+        }
+    }
+
+    psa_destroy_key(key_id);
+}
+
+ZTEST(crypto_lib, test_verify_mac_batch) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t key_id;
+    uint8_t key[KEY_LEN], input[SUBEVENT_INPUT_LEN];
+    // More than one chunk
+    uint8_t macs[CRYPTO_VERIFY_CHUNK + 2][MAC_LEN];
+    crypto_mac_job_t jobs[ARRAY_SIZE(macs)];
+    bool valid[ARRAY_SIZE(macs)];
+    size_t len;
+
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM))
+        ztest_test_skip();
+
+    for (size_t i = 0; i < sizeof(key); i++)
+        key[i] = 0x30 + i;
+    for (size_t i = 0; i < sizeof(input); i++)
+        input[i] = 5 * i;
+
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, key, sizeof(key), &key_id),
+                  PSA_SUCCESS);
+
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        jobs[i] = (crypto_mac_job_t){
+            .input = input + i, .input_len = sizeof(input) - i, .mac = macs[i]};
+        zassert_equal(psa_mac_compute(key_id, CRYPTO_ALG, jobs[i].input,
+                                      jobs[i].input_len, macs[i],
+                                      sizeof(macs[i]), &len),
+                      PSA_SUCCESS);
+    }
+    zassert_equal(crypto_verify_mac_batch(key_id, jobs, ARRAY_SIZE(jobs),
+                                          valid),
+                  PSA_SUCCESS);
+
+    // Only the last byte differs, in the second chunk
+    macs[CRYPTO_VERIFY_CHUNK + 1][MAC_LEN - 1] ^= 1;
+    zassert_equal(crypto_verify_mac_batch(key_id, jobs, ARRAY_SIZE(jobs),
+                                          valid),
+                  PSA_ERROR_INVALID_SIGNATURE);
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++)
+        zassert_equal(valid[i], i != CRYPTO_VERIFY_CHUNK + 1, "job %zu", i);
+
+    psa_destroy_key(key_id);
+}
+
+#if defined(CONFIG_CRYPTO_SIM_KEYS)
+ZTEST(crypto_lib, test_sim_keys) {
+    psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+    const uint8_t label[] = "pawr-sim-key\0\x07";
+    uint8_t digest[PSA_HASH_LENGTH(PSA_ALG_SHA_256)], expected[MAC_LEN];
+    uint8_t input[SUBEVENT_INPUT_LEN];
+    psa_key_id_t key_id;
+    size_t len;
+    CRYPTO_MAC_BUF_DEFINE(mac);
+    struct net_buf_simple input_buf;
+
+    if (IS_ENABLED(CONFIG_CRYPTO_AUTH_AES_CCM))
+        ztest_test_skip();
+
+    for (size_t i = 0; i < sizeof(input); i++)
+        input[i] = i;
+    net_buf_simple_init_with_data(&input_buf, input, sizeof(input));
+
+    // Label with its terminator, then device 7 as le16 with the literal's
+    // terminator as high byte
+    zassert_equal(psa_hash_compute(PSA_ALG_SHA_256, label, sizeof(label),
+                                   digest, sizeof(digest), &len),
+                  PSA_SUCCESS);
+    psa_set_key_type(&attributes, CRYPTO_KEY_TYPE);
+    psa_set_key_bits(&attributes, KEY_BITS);
+    psa_set_key_usage_flags(&attributes, KEY_FLAGS);
+    psa_set_key_algorithm(&attributes, CRYPTO_ALG);
+    zassert_equal(psa_import_key(&attributes, digest, KEY_LEN, &key_id),
+                  PSA_SUCCESS);
+    zassert_equal(psa_mac_compute(key_id, CRYPTO_ALG, input, sizeof(input),
+                                  expected, sizeof(expected), &len),
+                  PSA_SUCCESS);
+    psa_destroy_key(key_id);
+
+    // Leaves whatever the MAC path caches for device 6 behind
+    zassert_equal(crypto_sim_key_import(MIN_SCANNER_KEY_ID, 6), PSA_SUCCESS);
+    zassert_equal(crypto_compute_mac(MIN_SCANNER_KEY_ID, &input_buf,
+                                     sizeof(input), &mac),
+                  PSA_SUCCESS);
+    zassert_true(memcmp(mac.data, expected, MAC_LEN) != 0);
+
+    net_buf_simple_reset(&mac);
+    zassert_equal(crypto_sim_key_import(MIN_SCANNER_KEY_ID, 7), PSA_SUCCESS);
+    zassert_equal(crypto_compute_mac(MIN_SCANNER_KEY_ID, &input_buf,
+                                     sizeof(input), &mac),
+                  PSA_SUCCESS);
+    zassert_mem_equal(mac.data, expected, MAC_LEN,
+                      "importing again didn't replace the key");
+
+    zassert_equal(crypto_sim_key_import(PSA_KEY_ID_USER_MIN +
+                                            CONFIG_CRYPTO_SIM_KEYS_MAX,
+                                        1),
+                  PSA_ERROR_INVALID_ARGUMENT);
+}
+#endif // CONFIG_CRYPTO_SIM_KEYS
+
+ZTEST_SUITE(crypto_lib, NULL, crypto_setup, before, NULL, NULL);
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/bluetooth/hci.h>
+
+#include "bt_stub.h"
+
+struct bt_le_per_adv_sync {
+    bool used;
+    struct bt_le_per_adv_sync_param param;
+};
+
+bt_stub_t bt_stub;
+
+static struct bt_le_per_adv_sync syncs[CONFIG_BT_PER_ADV_SYNC_MAX];
+
+/** Interval of the periodic advertiser, in 1.25 ms units */
+#define SYNC_INTERVAL 2000
+
+void bt_stub_synced(struct bt_le_per_adv_sync *sync) {
+    struct bt_le_per_adv_sync_synced_info info = {
+        .addr = &sync->param.addr,
+        .sid = sync->param.sid,
+        .interval = SYNC_INTERVAL,
+        .num_subevents = 8,
+    };
+
+    bt_stub.sync_cb->synced(sync, &info);
+}
+
+void bt_stub_terminate(struct bt_le_per_adv_sync *sync) {
+    struct bt_le_per_adv_sync_term_info info = {
+        .addr = &sync->param.addr,
+        .sid = sync->param.sid,
+        .reason = BT_HCI_ERR_CONN_TIMEOUT,
+    };
+
+    sync->used = false;
+    bt_stub.sync_cb->term(sync, &info);
+}
+
+int bt_enable(bt_ready_cb_t cb) {
+    bt_stub.enable_calls++;
+    if (cb)
+        cb(0);
+    return 0;
+}
+
+int bt_le_scan_cb_register(struct bt_le_scan_cb *cb) {
+    bt_stub.scan_cb = cb;
+    return 0;
+}
+
+int bt_le_per_adv_sync_cb_register(struct bt_le_per_adv_sync_cb *cb) {
+    bt_stub.sync_cb = cb;
+    return 0;
+}
+
+int bt_le_scan_start(const struct bt_le_scan_param *param,
+                     bt_le_scan_cb_t cb) {
+    ARG_UNUSED(param);
+    ARG_UNUSED(cb);
+    if (bt_stub.scanning)
+        return -EALREADY;
+    bt_stub.scanning = true;
+    bt_stub.scan_starts++;
+    return 0;
+}
+
+int bt_le_scan_stop(void) {
+    if (!bt_stub.scanning)
+        return -EALREADY;
+    bt_stub.scanning = false;
+    bt_stub.scan_stops++;
+    return 0;
+}
+
+int bt_le_per_adv_sync_create(const struct bt_le_per_adv_sync_param *param,
+                              struct bt_le_per_adv_sync **out_sync) {
+    for (size_t i = 0; i < ARRAY_SIZE(syncs); i++) {
+        if (syncs[i].used)
+            continue;
+        syncs[i].used = true;
+        syncs[i].param = *param;
+        *out_sync = &syncs[i];
+        return 0;
+    }
+    return -ENOMEM;
+}
+
+int bt_le_per_adv_sync_delete(struct bt_le_per_adv_sync *per_adv_sync) {
+    if (!per_adv_sync->used)
+        return -EINVAL;
+    per_adv_sync->used = false;
+    return 0;
+}
+
+uint8_t bt_le_per_adv_sync_get_index(struct bt_le_per_adv_sync *per_adv_sync) {
+    return per_adv_sync - syncs;
+}
+
+int bt_le_per_adv_sync_get_info(struct bt_le_per_adv_sync *per_adv_sync,
+                                struct bt_le_per_adv_sync_info *info) {
+    bt_addr_le_copy(&info->addr, &per_adv_sync->param.addr);
+    info->sid = per_adv_sync->param.sid;
+    info->interval = SYNC_INTERVAL;
+    info->phy = BT_GAP_LE_PHY_2M;
+    return 0;
+}
+
+int bt_le_per_adv_sync_recv_enable(struct bt_le_per_adv_sync *per_adv_sync) {
+    ARG_UNUSED(per_adv_sync);
+    return 0;
+}
+
+int bt_le_per_adv_sync_recv_disable(struct bt_le_per_adv_sync *per_adv_sync) {
+    ARG_UNUSED(per_adv_sync);
+    return 0;
+}
+
+int bt_le_per_adv_sync_subevent(
+    struct bt_le_per_adv_sync *per_adv_sync,
+    struct bt_le_per_adv_sync_subevent_params *params) {
+    if (params->num_subevents != 1)
+        return -EINVAL;
+    bt_stub.subevent[bt_le_per_adv_sync_get_index(per_adv_sync)] =
+        params->subevents[0];
+    return 0;
+}
+
+int bt_le_per_adv_set_response_data(
+    struct bt_le_per_adv_sync *per_adv_sync,
+    const struct bt_le_per_adv_response_params *params,
+    const struct net_buf_simple *data) {
+    ARG_UNUSED(per_adv_sync);
+    ARG_UNUSED(params);
+    ARG_UNUSED(data);
+    return 0;
+}
+
+void bt_data_parse(struct net_buf_simple *ad,
+                   bool (*func)(struct bt_data *data, void *user_data),
+                   void *user_data) {
+    while (ad->len > 1) {
+        struct bt_data data;
+        uint8_t len = net_buf_simple_pull_u8(ad);
+
+        if (len == 0 || len > ad->len)
+            return;
+        data.type = net_buf_simple_pull_u8(ad);
+        data.data_len = len - 1;
+        data.data = ad->data;
+        if (!func(&data, user_data))
+            return;
+        net_buf_simple_pull(ad, data.data_len);
+    }
+}
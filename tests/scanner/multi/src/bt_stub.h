@@ -0,0 +1,36 @@
+#ifndef BT_STUB_H
+#define BT_STUB_H
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/kernel.h>
+
+/**
+ * \brief What the scanners asked of the host.
+ * Filled in by the stand-ins for the bt_le_scan and bt_le_per_adv_sync calls
+ * in bt_stub.c, read by the test in place of a controller.
+ */
+typedef struct {
+    struct bt_le_scan_cb *scan_cb;
+    struct bt_le_per_adv_sync_cb *sync_cb;
+    uint32_t enable_calls;
+    uint32_t scan_starts;
+    uint32_t scan_stops;
+    bool scanning;
+    /** Subevent each sync was last told to receive, by sync index */
+    uint8_t subevent[CONFIG_BT_PER_ADV_SYNC_MAX];
+} bt_stub_t;
+
+extern bt_stub_t bt_stub;
+
+/**
+ * \brief Reports sync as established to the sync callbacks.
+ */
+void bt_stub_synced(struct bt_le_per_adv_sync *sync);
+
+/**
+ * \brief Reports sync as lost to the sync callbacks and frees it, the way the
+ * host does on a sync timeout.
+ */
+void bt_stub_terminate(struct bt_le_per_adv_sync *sync);
+
+#endif // BT_STUB_H
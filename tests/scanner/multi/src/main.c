@@ -0,0 +1,134 @@
+/*
+ * @file scanner multi instance test
+ *
+ * Runs two scanners of scanner_fsm.c in one image against the host stand-in
+ * in bt_stub.c. They share bt_enable_mutex and the scan queue: Bluetooth is
+ * enabled and scanning started once for both, one scan report syncs both of
+ * them, and a scanner that loses its sync scans again on its own while the
+ * other one keeps its sync.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <app/lib/common.h>
+#include <app/lib/transfer.h>
+
+#include "bt_stub.h"
+#include "scanner_fsm.h"
+
+#define NUM_SCANNERS 2
+BUILD_ASSERT(NUM_SCANNERS <= CONFIG_BT_PER_ADV_SYNC_MAX);
+
+#define SCANNER_STACK_SIZE 4096
+#define SCANNER_PRIORITY K_PRIO_PREEMPT(1)
+
+/** Above any counter a fresh scanner starts from */
+#define ADV_COUNTER (4 * CONFIG_CRYPTO_COUNTER_LEASE)
+/** Subevent of every register slot in the adv data */
+#define REG_SUBEVENT 3
+
+K_THREAD_STACK_ARRAY_DEFINE(scanner_stacks, NUM_SCANNERS, SCANNER_STACK_SIZE);
+static struct k_thread scanner_threads[NUM_SCANNERS];
+static scanner_t scanners[NUM_SCANNERS];
+
+static const bt_addr_le_t adv_addr = {
+    .type = BT_ADDR_LE_RANDOM,
+    .a = {{0x01, 0x02, 0x03, 0x04, 0x05, 0xc6}},
+};
+
+/**
+ * \brief Hands the scanners an extended advertisement with signed adv data,
+ * as the host does for every scan report.
+ */
+static void scan_report(uint64_t counter) {
+    register_data_t reg[2] = {{.subevent = REG_SUBEVENT, .rsp_slot = 0},
+                              {.subevent = REG_SUBEVENT, .rsp_slot = 1}};
+    advertisement_data_t adv = {
+        .reg_data = reg,
+        .selection_info = {.num_reg_slots = ARRAY_SIZE(reg)},
+        .counter = counter,
+    };
+    struct bt_le_scan_recv_info info = {
+        .addr = &adv_addr,
+        .sid = 1,
+        .adv_props = BT_GAP_ADV_PROP_EXT_ADV,
+        .interval = 2000,
+    };
+
+    NET_BUF_SIMPLE_DEFINE(message, UINT8_MAX);
+    NET_BUF_SIMPLE_DEFINE(ad, UINT8_MAX);
+
+    advertisement_data_serialize(&adv, &message);
+    zassert_ok(sign_message(&message, ADVERTISER_KEY_ID));
+    net_buf_simple_add_u8(&ad, message.len + 1);
+    net_buf_simple_add_u8(&ad, BT_DATA_MANUFACTURER_DATA);
+    net_buf_simple_add_mem(&ad, message.data, message.len);
+
+    bt_stub.scan_cb->recv(&info, &ad);
+}
+
+ZTEST(scanner_multi, test_shared_scan) {
+    struct bt_le_per_adv_sync *kept;
+
+    zassert_equal(bt_stub.enable_calls, 1, "Bluetooth enabled per scanner");
+    zassert_equal(bt_stub.scan_starts, 1, "scanning started per scanner");
+    zassert_true(bt_stub.scanning);
+
+    // One report syncs every queued scanner, then scanning stops
+    scan_report(ADV_COUNTER);
+    zassert_false(bt_stub.scanning, "scanning went on with nobody queued");
+    zassert_equal(bt_stub.scan_stops, 1);
+    for (size_t i = 0; i < NUM_SCANNERS; i++)
+        zassert_not_null(scanners[i].sync, "scanner %zu not synced", i);
+    zassert_not_equal(scanners[0].sync, scanners[1].sync);
+
+    // The sync callbacks find the scanner owning each sync
+    for (size_t i = 0; i < NUM_SCANNERS; i++) {
+        bt_stub_synced(scanners[i].sync);
+        zassert_equal(
+            bt_stub.subevent[bt_le_per_adv_sync_get_index(scanners[i].sync)],
+            REG_SUBEVENT);
+    }
+
+    // Losing a sync only sends its own scanner back to the queue, once
+    // confirming gave up waiting
+    kept = scanners[1].sync;
+    bt_stub_terminate(scanners[0].sync);
+    k_sleep(K_SECONDS(3));
+    zassert_is_null(scanners[0].sync);
+    zassert_equal(scanners[1].sync, kept, "other scanner lost its sync");
+    zassert_equal(scanners[1].curr_state, CONFIRMING);
+    zassert_true(bt_stub.scanning, "queued scanner didn't start scanning");
+    zassert_equal(bt_stub.scan_starts, 2);
+
+    // A replayed report leaves the scanner queued, the next one syncs it
+    scan_report(ADV_COUNTER);
+    zassert_is_null(scanners[0].sync, "replayed adv data accepted");
+    zassert_true(bt_stub.scanning);
+    scan_report(ADV_COUNTER + 1);
+    zassert_not_null(scanners[0].sync);
+    zassert_false(bt_stub.scanning);
+    zassert_equal(bt_stub.scan_stops, 2);
+}
+
+static void scanner_main(void *p1, void *p2, void *p3) { scanner_run(p1); }
+
+static void *multi_setup(void) {
+    for (size_t i = 0; i < NUM_SCANNERS; i++) {
+        scanner_init(&scanners[i], i + 1, MIN_SCANNER_KEY_ID + i,
+                     COUNTER_ID + i);
+        k_thread_create(&scanner_threads[i], scanner_stacks[i],
+                        K_THREAD_STACK_SIZEOF(scanner_stacks[i]), scanner_main,
+                        &scanners[i], NULL, NULL, SCANNER_PRIORITY, 0,
+                        K_NO_WAIT);
+    }
+
+    // Scanners wait 5 s in init, then both queue for a scan report
+    k_sleep(K_SECONDS(6));
+    for (size_t i = 0; i < NUM_SCANNERS; i++)
+        zassert_equal(scanners[i].curr_state, SYNCING, "scanner %zu stuck", i);
+    return NULL;
+}
+
+ZTEST_SUITE(scanner_multi, NULL, multi_setup, NULL, NULL, NULL);